@@ -0,0 +1,124 @@
+// compares flatTable with std::unordered_map for the kinds of keys the runtime uses.
+// build and run with 'make tablebench'
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "../header/virtualMachine/table.hpp"
+
+// stands in for objString*, only the address is used
+struct fakeObject {
+	char padding[48];
+};
+
+// the bits of a NaN-boxed double, like the keys of objMap
+struct bitsHash {
+	size_t operator()(uint64_t bits) const {
+		return bits;
+	}
+};
+
+struct cStringHash {
+	size_t operator()(const char* str) const {
+		size_t hash = 0;
+		while (*str) {
+			hash = hash * 131 + *str++;
+		}
+		return hash;
+	}
+};
+
+struct cStringEqual {
+	bool operator()(const char* a, const char* b) const {
+		return std::strcmp(a, b) == 0;
+	}
+};
+
+template<typename F>
+static double timeMs(F body) {
+	auto start = std::chrono::steady_clock::now();
+	body();
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// inserts all keys, looks every key up a number of times, looks up keys that are missing and erases half
+template<typename Map, typename K>
+static double run(const std::vector<K>& keys, const std::vector<K>& missing, size_t rounds, size_t& checksum) {
+	return timeMs([&]() {
+		Map map;
+		for (size_t i = 0; i < keys.size(); i++) {
+			map.insert_or_assign(keys[i], i);
+		}
+		for (size_t round = 0; round < rounds; round++) {
+			for (auto& key : keys) {
+				checksum += map.find(key)->second;
+			}
+			for (auto& key : missing) {
+				checksum += map.find(key) == map.end();
+			}
+		}
+		for (size_t i = 0; i < keys.size(); i += 2) {
+			map.erase(keys[i]);
+		}
+		for (auto& el : map) {
+			checksum += el.second;
+		}
+	});
+}
+
+template<typename K, typename Hash, typename Equal = std::equal_to<K>>
+static void compare(const char* name, const std::vector<K>& keys, const std::vector<K>& missing, size_t rounds) {
+	size_t flatSum = 0, stdSum = 0;
+	double flat = run<flatTable<K, size_t, Hash, Equal>>(keys, missing, rounds, flatSum);
+	double standard = run<std::unordered_map<K, size_t, Hash, Equal>>(keys, missing, rounds, stdSum);
+
+	flatTable<K, size_t, Hash, Equal> table;
+	for (size_t i = 0; i < keys.size(); i++) {
+		table.insert_or_assign(keys[i], i);
+	}
+	tableStats stats = table.probeStats();
+
+	printf("%-10s %8zu keys  flatTable %8.2f ms  unordered_map %8.2f ms  average probe %.2f, longest %zu%s\n",
+		name, keys.size(), flat, standard, stats.averageProbe, stats.maxProbe, flatSum == stdSum ? "" : "  (MISMATCH)");
+}
+
+int main() {
+	for (size_t count : { 16, 1000, 100000 }) {
+		size_t rounds = 10000000 / count;
+
+		std::vector<fakeObject> objects(count * 2);
+		std::vector<fakeObject*> pointers, missingPointers;
+		for (size_t i = 0; i < count; i++) {
+			pointers.push_back(&objects[i]);
+			missingPointers.push_back(&objects[count + i]);
+		}
+		compare<fakeObject*, std::hash<fakeObject*>>("pointer", pointers, missingPointers, rounds);
+
+		std::vector<uint64_t> numbers, missingNumbers;
+		for (size_t i = 0; i < count; i++) {
+			double key = double(i), other = double(count + i);
+			uint64_t bits;
+			memcpy(&bits, &key, sizeof(bits));
+			numbers.push_back(bits);
+			memcpy(&bits, &other, sizeof(bits));
+			missingNumbers.push_back(bits);
+		}
+		compare<uint64_t, bitsHash>("number", numbers, missingNumbers, rounds);
+
+		std::vector<std::string> names;
+		for (size_t i = 0; i < count * 2; i++) {
+			names.push_back("name" + std::to_string(i));
+		}
+		std::vector<const char*> strings, missingStrings;
+		for (size_t i = 0; i < count; i++) {
+			strings.push_back(names[i].c_str());
+			missingStrings.push_back(names[count + i].c_str());
+		}
+		compare<const char*, cStringHash, cStringEqual>("string", strings, missingStrings, rounds / 4);
+	}
+	return 0;
+}
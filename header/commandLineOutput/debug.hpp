@@ -1,19 +1,36 @@
 #ifndef SHRIMPP_DEBUG_HPP
 #define SHRIMPP_DEBUG_HPP
 
+#include "../defines.hpp"
 #include "../virtualMachine/chunk.hpp"
 
 namespace debug {
     int constantInstruction(const char* name, chunk* ch, int offset);
+    int wideConstantInstruction(const char* name, chunk* ch, int offset);
     int appendInstruction(const char* name, chunk* ch, int offset);
     int byteInstruction(const char* name, chunk* ch, int offset);
     int simpleInstruction(const char* name, chunk* ch, int offset);
     int jumpInstruction(const char* name, int sign, chunk *ch, int offset);
+    int wideJumpInstruction(const char* name, int sign, chunk *ch, int offset);
     int callInstruction(const char* name, chunk* ch, int offset);
+    int countInstruction(const char* name, chunk* ch, int offset);
     int invokeInstruction(const char* name, chunk* ch, int offset);
+    int cachedConstantInstruction(const char* name, chunk* ch, int offset);
+    int localLocalInstruction(const char* name, chunk* ch, int offset);
+    int compareJumpInstruction(const char* name, bool constantOperand, chunk* ch, int offset);
+    int registerInstruction(const char* name, int operands, chunk* ch, int offset);
+    int registerJumpInstruction(const char* name, chunk* ch, int offset);
 
     int disassembleInstruction(char inst, chunk* ch, int offset);
     void disassembleChunk(chunk *ch);
+
+    const char* opcodeName(unsigned char inst);
+
+#ifdef DEBUG_PROFILE_OPCODES
+    // counts executed opcode pairs, used to pick superinstructions
+    void profileInstruction(unsigned char inst);
+    void printOpcodeProfile(size_t maxEntries);
+#endif
 }
 
 #endif //SHRIMPP_DEBUG_HPP
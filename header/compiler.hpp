@@ -100,6 +100,10 @@ class compiler {
 
 	std::vector<breaks> breakJumps;
 
+	// where the last OP_CALL ended and in which chunk, so returnStatement can tell if it returns a call
+	chunk* lastCallChunk = nullptr;
+	size_t lastCallEnd = 0;
+
 	void errorAt(token tk, const char* msg);
 
 	void error(const char* msg);
@@ -120,6 +124,13 @@ class compiler {
 
 	void emitBytes(char a, char b);
 
+	void emitShort(uint16_t operand);
+
+	void emitInt(uint32_t operand);
+
+	// adds an inline cache to the current chunk and emits its index
+	void emitCache();
+
 	size_t emitJump(opCodes jmpCode);
 
 	void emitLoop(size_t loopStart);
@@ -132,6 +143,12 @@ class compiler {
 
 	int identifierConstant(token& name);
 
+	/**
+	 * resolves the name of a global variable to its slot in the global table of the vm.
+	 * every compiler of the vm (also those of imported files) shares this table
+	 */
+	int globalSlot(token& name);
+
 	void declareVariable(bool isConst);
 
 	int resolveLocal(bool &isConst);
@@ -188,6 +205,9 @@ class compiler {
 
 	void function();
 
+	// runs the backend passes on a finished function
+	void optimizeFunction(objFunction* function);
+
 	void functionDeclaration();
 
 	void classDeclaration();
@@ -256,6 +276,12 @@ class compiler {
 
 	static void binary(bool canAssign, compiler& cmp);
 
+	// compiles the right operands of a chain of '+', see OP_CONCAT_N
+	void addition();
+
+	// whether the code from start to the end of the chunk is a single string constant
+	bool isStringConstant(size_t start);
+
 	static void unary(bool canAssign, compiler& cmp);
 
 	static void literal(bool canAssign, compiler& cmp);
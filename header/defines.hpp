@@ -4,6 +4,14 @@
 // enables NaN-boxing, may not work/be efficient on all devices
 #define NAN_BOXING
 
+// dispatches opcodes through a table of label addresses (computed goto) instead of a switch
+// only has an effect with compilers supporting labels as values (GCC/Clang)
+#define COMPUTED_GOTO
+
+#if defined(COMPUTED_GOTO) && (defined(__GNUC__) || defined(__clang__))
+#define THREADED_DISPATCH
+#endif
+
 // #define DEBUG_TESTFILE "shrimpcode.shrimp"
 
 // for debugging imports
@@ -14,4 +22,10 @@
 // #define DEBUG_STRESS_GC
 // #define DEBUG_LOG_GC
 
+// counts executed opcode pairs and prints the most frequent ones when the VM exits
+// #define DEBUG_PROFILE_OPCODES
+
+// prints how far lookups in the hash tables of the runtime have to probe when the VM exits
+// #define DEBUG_TABLE_STATS
+
 #endif //SHRIMPP_DEFINES_HPP
@@ -0,0 +1,8 @@
+#pragma once
+
+#include "../virtualMachine/VM.hpp"
+
+class nativeDictClass {
+public:
+	static void nativeDictFunctions(VM& vm);
+};
\ No newline at end of file
@@ -0,0 +1,8 @@
+#pragma once
+
+#include "../virtualMachine/VM.hpp"
+
+class nativeStringBuilderClass {
+public:
+	static void nativeStringBuilderFunctions(VM& vm);
+};
\ No newline at end of file
@@ -0,0 +1,16 @@
+#ifndef SHRIMPP_PEEPHOLE_HPP
+#define SHRIMPP_PEEPHOLE_HPP
+
+#include "./virtualMachine/chunk.hpp"
+
+/*
+ * rewrites frequent instruction sequences of a finished chunk into superinstructions.
+ * the fused sequences were picked from the opcode pair histogram (DEBUG_PROFILE_OPCODES)
+ * of the scripts in benchmark/. a sequence is only fused if no jump lands inside of it,
+ * all jump offsets are recalculated afterwards
+ */
+namespace peephole {
+	void optimizeChunk(chunk* ch);
+}
+
+#endif //SHRIMPP_PEEPHOLE_HPP
@@ -0,0 +1,22 @@
+#ifndef SHRIMPP_REGISTERCOMPILER_HPP
+#define SHRIMPP_REGISTERCOMPILER_HPP
+
+class objFunction;
+
+/*
+ * the code generator of the register backend ('shrimp --vm=reg').
+ * it lowers the stack bytecode of a finished function into three-address instructions,
+ * whose operands name frame slots (locals and temporaries) or constants directly.
+ * a value pushed by the stack code lives in the frame slot of its stack depth, so
+ * instructions without a register form keep running as stack instructions in between
+ */
+namespace registerCompiler {
+	/**
+	 * rewrites the code of the function into register form.
+	 *
+	 * \returns false and leaves the code untouched, if it couldn't be lowered
+	 */
+	bool translateFunction(objFunction* function);
+}
+
+#endif //SHRIMPP_REGISTERCOMPILER_HPP
@@ -4,7 +4,8 @@ so the import statement can easily execute extra files
 */
 
 class VM;
+enum vmBackend : char;
 
-bool runFile(const char* path);
+bool runFile(const char* path, vmBackend backend);
 
 bool runImportFile(const char* path, VM& vm);
\ No newline at end of file
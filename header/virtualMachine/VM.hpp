@@ -2,7 +2,7 @@
 #define SHRIMPP_VM_HPP
 
 #include <functional>
-#include <unordered_map>
+#include <vector>
 #include <cstring>
 
 #include "../defines.hpp"
@@ -10,17 +10,35 @@
 #include "../compiler.hpp"
 
 #include "memoryManager.hpp"
+#include "table.hpp"
 
-#ifdef DEBUG_TRACE_EXECUTION
+#if defined(DEBUG_TRACE_EXECUTION) || defined(DEBUG_PROFILE_OPCODES)
 
 #include "../commandLineOutput/debug.hpp"
 
 #endif
 
 
-#define FRAMES_MAX 128
-#define STACK_MAX (256 * FRAMES_MAX)
+// the value stack and the call frames start with these sizes and double whenever they are full
+#define STACK_INITIAL_SIZE 256
+#define FRAMES_INITIAL_SIZE 16
 
+// the sizes the stacks may grow to before a script fails with a stack overflow.
+// VM::setStackLimits changes the soft limits of a VM, up to the hard limits
+#define STACK_SOFT_LIMIT (1 << 20)
+#define FRAMES_SOFT_LIMIT (1 << 16)
+#define STACK_HARD_LIMIT (1 << 27)
+#define FRAMES_HARD_LIMIT (1 << 24)
+
+// how many calls a runtime error lists at most
+#define TRACEBACK_MAX 32
+
+
+// selected with 'shrimp --vm=reg', see registerCompiler.hpp
+enum vmBackend : char {
+    BACKEND_STACK,
+    BACKEND_REGISTER
+};
 
 enum exitCodes {
     INTERPRET_OK,
@@ -43,6 +61,8 @@ class VM {
     friend class nativeMathClass;
     friend class nativeArrayClass;
     friend class nativeFileClass;
+    friend class nativeDictClass;
+    friend class nativeStringBuilderClass;
 
 
     bool gcReady = false;
@@ -60,28 +80,53 @@ class VM {
     std::vector<objClosure*> scriptClosures;
     size_t currentScript = 0;
 
-    //size_t stackSize = 0;
     value *stack;
+    // one past the last allocated slot of the stack
+    value *stackEnd;
 
     value *activeCallFrameBottom;
     value *stackTop;
 
-    callFrame callFrames[FRAMES_MAX];
+    std::vector<callFrame> callFrames;
     size_t callDepth = 0;
 
-    std::unordered_map<objString*, value> globals;
+    size_t stackLimit = STACK_SOFT_LIMIT;
+    size_t frameLimit = FRAMES_SOFT_LIMIT;
+
+    /**
+     * makes sure there is room for the given number of values above stackTop.
+     * if the stack has to grow, it moves and all pointers into it are updated,
+     * so the caller has to reload any it cached.
+     *
+     * \returns false, if the stack would exceed its limit
+     */
+    inline bool reserveStack(size_t slots) {
+        return size_t(stackEnd - stackTop) >= slots || growStack(slots);
+    }
+
+    bool growStack(size_t slots);
+
+    // the values of all global variables. the compiler resolves every global name to
+    // its slot in here, a slot that wasn't defined yet holds UNDEFINED_VAL
+    std::vector<value> globals;
+    // the name of every slot, for error messages
+    std::vector<objString*> globalNames;
+    flatTable<objString*, size_t> globalSlots;
+
+    // defines a global from native code, with the same slot the compiler resolves the name to
+    void defineGlobal(objString* name, value val);
 
     // the compiler uses this vector to store all the consts names
     // if import is used, the new compiler gets the same vector,
     // so consts are still known as const during the compilation time
     std::vector<std::string> constVector;
 
-    // pointers to classes for builtins, for fast access
-    // also these don't have the pointers themselves
-    // the vm handles this
-    objClass* stringClass;
-    objClass* arrayClass;
-    objClass* fileClass;
+    // the class with the methods of every built-in type, indexed by objType.
+    // nullptr for types without methods
+    objClass* builtinClasses[OBJ_STRING_BUILDER + 1] = {};
+
+    // makes the methods of klass callable on every object of the type, after they were added to it
+    void defineBuiltinClass(objType type, objClass* klass);
 
     char *ip;
 
@@ -90,29 +135,9 @@ class VM {
 
     inline unsigned char readByte() { return *(ip++); }
 
-    inline short readShort() {
-        short res = short(readByte()) << 8;
-        res |= readByte();
-        return res;
-    }
-    // optimize this function
-    inline size_t readSizeT() {
-        size_t res = size_t(*(ip++));
-        res <<= 8;
-        res |= size_t(*(ip++));
-    	res <<= 8;
-        res |= size_t(*(ip++));
-        res <<= 8;
-        res |= size_t(*(ip++));
-        res <<= 8;
-        res |= size_t(*(ip++));
-        res <<= 8;
-        res |= size_t(*(ip++));
-        res <<= 8;
-        res |= size_t(*(ip++));
-        res <<= 8;
-        res |= size_t(*(ip++));
-        return res;
+    inline uint16_t readShort() {
+        ip += 2;
+        return decodeShort(ip - 2);
     }
 
     void push(value val);
@@ -126,6 +151,9 @@ class VM {
     ///The functions responsible for executing OP-codes
     bool concatenateTwoStrings();
 
+    // replaces the top count values with their sum, for OP_CONCAT_N
+    bool concatenateStrings(size_t count);
+
     bool add();
 
     bool sub();
@@ -142,6 +170,7 @@ class VM {
 
     bool callValue(value callee, int arity);
     bool call(value callee, int arity);
+    bool callNative(objNativeFunction* native, int arity);
 
     void defineMethod();
 
@@ -171,6 +200,9 @@ public:
     // the path that gets added to imported files, so they are always relative to the executed file
     std::string currentPath;
 
+    // the code generator used for every function compiled by this VM
+    vmBackend backend = BACKEND_STACK;
+
     ~VM();
 
     VM();
@@ -184,7 +216,19 @@ public:
 
     exitCodes run();
 
+    /**
+     * returns the slot of the global variable with the given name.
+     * the slot is created and left undefined, if the name is unknown
+     */
+    size_t globalSlot(objString* name);
+
     value replGetLast();
+
+    /**
+     * sets how many values the stack and how many calls the call stack may hold,
+     * both are clamped to STACK_HARD_LIMIT and FRAMES_HARD_LIMIT
+     */
+    void setStackLimits(size_t maxValues, size_t maxFrames);
 };
 
 
@@ -1,19 +1,50 @@
 #include <vector>
 #include <string>
+#include <cstdint>
+#include <cstring>
 
 #include "value.hpp"
 
 #ifndef SHRIMPP_CHUNK_HPP
 #define SHRIMPP_CHUNK_HPP
 
+#define REG_CONSTANT_BIT 0x8000
+
+/*
+ * bytecode format v2: an instruction is its opcode byte followed by fixed-width operands.
+ * 16-bit operands (slots, constant indexes and jumps) and 32-bit operands (the _WIDE variants
+ * and lengths) are stored in the byte order of the host, so the VM reads each with a single load
+ */
+inline uint16_t decodeShort(const char* bytes) {
+    uint16_t val;
+    std::memcpy(&val, bytes, sizeof(val));
+    return val;
+}
+
+inline uint32_t decodeInt(const char* bytes) {
+    uint32_t val;
+    std::memcpy(&val, bytes, sizeof(val));
+    return val;
+}
+
+inline void encodeShort(char* bytes, uint16_t val) {
+    std::memcpy(bytes, &val, sizeof(val));
+}
+
+inline void encodeInt(char* bytes, uint32_t val) {
+    std::memcpy(bytes, &val, sizeof(val));
+}
+
 enum opCodes : char {
     OP_CONSTANT,
+    OP_CONSTANT_WIDE,    // 32-bit constant index
 
     OP_ADD,
     OP_SUB,
     OP_MUL,
     OP_DIV,
     OP_MODULO,
+    OP_CONCAT_N,         // adds the top count values, emitted for chains of '+' that contain a string literal
 
     OP_NEGATE,
     OP_NOT,
@@ -58,15 +89,21 @@ enum opCodes : char {
     OP_SET_UPVALUE,
     OP_CLOSE_UPVALUE,
 
+    // the _WIDE jumps have a 32-bit offset, the compiler emits those for forward jumps
+    // and the optimization passes shorten them where the offset fits into 16 bits
     OP_JUMP,
+    OP_JUMP_WIDE,
     OP_JUMP_IF_FALSE,
+    OP_JUMP_IF_FALSE_WIDE,
 
     OP_LOOP,
+    OP_LOOP_WIDE,
 
     // OP_FUNCTION,
 
     OP_CLOSURE,
     OP_CALL,
+    OP_TAIL_CALL,        // a call directly followed by OP_RETURN, reuses the frame of the returning function
 
 
     OP_SET_PROPERTY,
@@ -90,10 +127,70 @@ enum opCodes : char {
     OP_SUPER,
     OP_SUPER_INVOKE,
 
+    // superinstructions, only emitted by the peephole pass (see peephole.hpp)
+    OP_ADD_LOCAL_LOCAL,
+    OP_LESS_LOCAL_CONST_JUMP,
+    OP_LESS_LOCAL_LOCAL_JUMP,
+    OP_LESS_EQUAL_LOCAL_LOCAL_JUMP,
+    OP_GET_PROPERTY_THIS,
+    OP_SET_LOCAL_POP,
+
+    // quickened instructions, the VM rewrites OP_ADD in place to these once it saw the operand types.
+    // if their guard fails, they rewrite themselves back to OP_ADD
+    OP_ADD_NUM,
+    OP_ADD_STR,
+
+    // register instructions, only emitted by the register backend (see registerCompiler.hpp)
+    // their operands are frame slots, or constants if REG_CONSTANT_BIT is set
+    OP_REG_MOVE,
+    OP_REG_SET_TOP,
+    OP_REG_ADD,
+    OP_REG_SUB,
+    OP_REG_MUL,
+    OP_REG_DIV,
+    OP_REG_MODULO,
+    OP_REG_JUMP_IF_NOT_LESSER,
+    OP_REG_JUMP_IF_NOT_LESSER_OR_EQUALS,
+    OP_REG_JUMP_IF_NOT_GREATER,
+    OP_REG_JUMP_IF_NOT_GREATER_OR_EQUALS,
+    OP_REG_JUMP_IF_NOT_EQUALS,
+    OP_REG_JUMP_IF_NOT_NOT_EQUALS,
+    OP_REG_RETURN,
+
     OP_IMPORT,
     OP_RETURN,
 };
 
+class objClass;
+class shape;
+
+// how many classes or shapes a single property access or invoke remembers
+#define INLINE_CACHE_SIZE 4
+
+struct inlineCacheEntry {
+    // the class the entry was found for, the GC keeps it and so its shapes alive
+    objClass* klass = nullptr;
+    // the shape of the instance, nullptr for lookups on classes and builtins
+    shape* layout = nullptr;
+    // the field with the name, or -1 if the class provides the value in method
+    long slot = -1;
+    value method;
+    // only for OP_SET_PROPERTY, the shape of the instance after the assignment
+    shape* target = nullptr;
+};
+
+/*
+ * what a property access or invoke found for the last shapes or classes it saw, so a site
+ * that keeps seeing the same few of them skips the field and method lookups.
+ * the entries are dropped when any class changes, see objClass::generation
+ */
+struct inlineCache {
+    inlineCacheEntry entries[INLINE_CACHE_SIZE];
+    size_t generation = 0;
+    // the entry replaced on the next miss
+    unsigned char next = 0;
+};
+
 class chunk {
     std::string name;
     std::vector<char> code;
@@ -101,11 +198,17 @@ class chunk {
 public:
     std::vector<value> constants;
     std::vector<unsigned int> lines;
+    // indexed by the cache operand of the property access and invoke instructions
+    std::vector<inlineCache> caches;
 
     chunk() = default;
 
     void addByte(char byte, unsigned int line);
 
+    void addShort(uint16_t val, unsigned int line);
+
+    void addInt(uint32_t val, unsigned int line);
+
     unsigned int addConstantGetLine(value constant, unsigned int line);
 
     void writeConstant(value constant, unsigned int line);
@@ -128,7 +231,43 @@ public:
 
     char &accessAt(size_t pos);
 
-    inline value getConstant(short index) const { return constants.at(index); }
+    inline uint16_t readShortAt(size_t pos) const { return decodeShort(&code.at(pos)); }
+
+    inline uint32_t readIntAt(size_t pos) const { return decodeInt(&code.at(pos)); }
+
+    inline void patchShortAt(size_t pos, uint16_t val) { encodeShort(&code.at(pos), val); }
+
+    inline void patchIntAt(size_t pos, uint32_t val) { encodeInt(&code.at(pos), val); }
+
+    // the length of the instruction at offset, including its operands
+    size_t instructionLength(size_t offset) const;
+
+    /**
+     * how the instruction at offset changes the stack depth.
+     *
+     * \returns false for opcodes that aren't emitted by the compiler
+     */
+    bool stackEffect(size_t offset, long &effect) const;
+
+    // the most values a frame running this code holds at once, its arguments included
+    size_t maxStackDepth(size_t arity) const;
+
+    // removes the bytes at the given positions, which have to be ascending
+    void removeBytes(const std::vector<size_t> &positions);
+
+    // used by the peephole pass, which rewrites the whole code at once
+    void replaceCode(std::vector<char> &&newCode, std::vector<unsigned int> &&newLines);
+
+    inline value getConstant(size_t index) const { return constants.at(index); }
+
+    inline const value* getConstantsPtr() const { return constants.data(); }
+
+    inline size_t addCache() {
+        caches.emplace_back();
+        return caches.size() - 1;
+    }
+
+    inline inlineCache* getCachesPtr() { return caches.data(); }
 };
 
 
@@ -4,35 +4,31 @@
 #include "obj.hpp"
 #include "../defines.hpp"
 #include <iostream>
-#include <unordered_map>
+#include "table.hpp"
 #include <cstring>
+#include <string_view>
 #include <vector>
 
 #define GC_GROWTH_FACTOR 2
 
+// new objects are young until they survive a collection. a minor collection only traces the young
+// objects, it runs whenever this many bytes were allocated since the last one
+#define GC_NURSERY_SIZE (1024 * 1024)
 
-template<typename Tp>
-struct my_equal_to : public std::equal_to<Tp>
-{
-    constexpr bool operator()(const Tp& _x, const Tp& _y) const
-    {
-        return std::strcmp(_x, _y) == 0;
-    }
-};
+#ifdef DEBUG_STRESS_GC
+// with DEBUG_STRESS_GC every allocation does a minor collection and every this many a major one
+#define GC_STRESS_MAJOR_EVERY 16
+#endif
+
+// to_string returns the strings of the integers from 0 to SMALL_INT_STRINGS - 1 from a cache
+#define SMALL_INT_STRINGS 1024
 
-struct Hash_Func {
-    //BKDR hash algorithm
-    int operator()(const char* str)const
-    {
-        int seed = 131;//31  131 1313 13131131313 etc//
-        int hash = 0;
-        while (*str)
-        {
-            hash = (hash * seed) + (*str);
-            str++;
-        }
 
-        return hash & (0x7FFFFFFF);
+// interned strings are unique, so the table compares them by identity and hashes them by their cached hash.
+// new strings are looked up by their characters with findAs
+struct internedHash {
+    size_t operator()(const objString* str) const {
+        return str->hash;
     }
 };
 
@@ -43,12 +39,32 @@ class memoryManager {
     VM *vm;
 
     std::vector<obj*> grayStack;
+    // the old objects, only freed by a major collection
     obj* allObjects = nullptr;
+    // the objects allocated since the last collection
+    obj* youngObjects = nullptr;
+
+    // the old objects that got a reference to a young one stored in them (see obj::writeBarrier)
+    std::vector<obj*> rememberedSet;
 
     size_t bytesAllocated = 0;
+    // the part of bytesAllocated that is young
+    size_t youngBytes = 0;
 
+    // a major collection runs when the old objects grow beyond this
     size_t nextGC = 1024 * 256;
 
+    // while true markObject ignores old objects
+    bool collectingYoung = false;
+
+#ifdef DEBUG_STRESS_GC
+    size_t stressCollections = 0;
+    // while true markObject checks that every young object an old one references was marked
+    bool verifyingBarriers = false;
+
+    void verifyBarriers();
+#endif
+
     void markRoots();
 
     void markObject(obj *obj);
@@ -63,18 +79,74 @@ class memoryManager {
 
     void sweep();
 
+    // frees the unmarked young objects and makes the others old
+    void sweepYoung();
+
+    // makes all young objects old without collecting them
+    void promoteAll();
+
     void addToObjects(obj* o);
 
+    inline void collectIfNeeded() {
+#ifdef DEBUG_STRESS_GC
+        if (++stressCollections % GC_STRESS_MAJOR_EVERY == 0) {
+            collectGarbage();
+        }
+        else {
+            collectYoung();
+        }
+#else
+        if (bytesAllocated - youngBytes > nextGC) {
+            collectGarbage();
+        }
+        else if (youngBytes > GC_NURSERY_SIZE) {
+            collectYoung();
+        }
+#endif
+    }
+
+    void createStringCaches();
+
 public:
 
+    // a major collection, it traces and sweeps all objects
     void collectGarbage();
 
+    // a minor collection, it only frees young objects that are unreachable. the roots and the
+    // remembered set are traced, the old objects they reference aren't
+    void collectYoung();
+
+    inline void remember(obj* object) {
+        object->isRemembered = true;
+        rememberedSet.push_back(object);
+    }
+
     size_t getHeapSize();
 
-    std::unordered_map<const char*, objString*, Hash_Func, my_equal_to<const char*>> internedStrings;
+    flatTable<objString*, noValue, internedHash> internedStrings;
+
+    // the interned string with the characters of first followed by second, or nullptr
+    objString* findInterned(std::string_view first, std::string_view second, uint32_t hash);
+
+    // a string with room for len characters and the terminating 0 behind it, one allocation
+    objString* allocateString(unsigned int len);
 
     objString* initString;
 
+    // the string of every single byte and of the small integers, created with the memory manager and
+    // never collected, so at(), to_chr() and to_string() return them without hashing anything
+    objString* charStrings[256];
+    objString* intStrings[SMALL_INT_STRINGS];
+
+    // counts memory an object owns outside of its allocation, like the buffer of a string builder,
+    // so growing it brings the next collection closer
+    inline void resizedBuffer(size_t oldSize, size_t newSize) {
+        bytesAllocated += newSize - oldSize;
+    }
+
+    // objects only referenced by native code, that allocates more objects before it returns them
+    std::vector<obj*> temporaryRoots;
+
     explicit memoryManager(VM &v);
 
     ~memoryManager();
@@ -83,6 +155,11 @@ public:
 
     void setVM(VM* v);
 
+#ifdef DEBUG_TABLE_STATS
+    // the probe lengths of the intern table, the globals and of the tables of all live classes and maps
+    void printTableStats();
+#endif
+
     template<typename T>
     T *allocateObject();
 
@@ -98,19 +175,14 @@ public:
 template<typename T>
 T *memoryManager::allocateObject() {
 
-#ifdef DEBUG_STRESS_GC
-    collectGarbage();
-#else
-    if (bytesAllocated > nextGC) {
-        collectGarbage();
-    }
-#endif
+    collectIfNeeded();
 
     obj *res = new T;
 
     addToObjects(res);
 
     bytesAllocated += sizeof(T);
+    youngBytes += sizeof(T);
 
     //std::cout << "allocated:" << bytesAllocated << std::endl;
     return (T*)res;
@@ -127,12 +199,7 @@ void memoryManager::freeArray(T *arr, unsigned int len) {
 
 template<typename T>
 T *memoryManager::allocateArray(unsigned long long len) {
-#ifdef DEBUG_STRESS_GC
-    collectGarbage();
-#endif
-    if (bytesAllocated > nextGC) {
-        collectGarbage();
-    }
+    collectIfNeeded();
 
     T* res = new T[len];
 
@@ -1,15 +1,20 @@
 #ifndef SHRIMPP_OBJ_HPP
 #define SHRIMPP_OBJ_HPP
 
-#include <unordered_map>
 #include <fstream>
 #include <vector>
+#include <memory>
+#include <cstdint>
+#include <string>
 
 #include "value.hpp"
+#include "table.hpp"
 
 class VM;
 class chunk;
 
+#define NO_SYMBOL UINT32_MAX
+
 typedef value(*nativeFn)(int arity, value* args, bool& success);
 
 enum objType : char {
@@ -22,7 +27,8 @@ enum objType : char {
 	OBJ_INSTANCE,
 	OBJ_LIST,
 	OBJ_MAP,
-	OBJ_FILE
+	OBJ_FILE,
+	OBJ_STRING_BUILDER
 };
 
 class obj {
@@ -30,9 +36,16 @@ class obj {
 protected:
 	objType type;
 	bool isMarked = false;
+	// survived a collection, so only a major collection traces it (see memoryManager::collectYoung)
+	bool isOld = false;
+	// already in the remembered set of the memory manager
+	bool isRemembered = false;
 	obj* next = nullptr;
 
 	~obj() = default;
+
+	// adds this object to the remembered set, so the next minor collection traces it
+	void remember();
 public:
 
 	obj* getNext() const;
@@ -40,21 +53,94 @@ public:
 		return type;
 	}
 
+	inline bool isYoung() const {
+		return !isOld;
+	}
+
+	// has to be called whenever a reference to o is stored in this object, outside of the roots.
+	// a minor collection only traces old objects that got a young one stored in them
+	inline void writeBarrier(obj* o) {
+		if (isOld && !isRemembered && o != nullptr && !o->isOld) {
+			remember();
+		}
+	}
+
+	inline void writeBarrier(value val) {
+		if (isOld && !isRemembered && IS_OBJ(val) && !AS_OBJ(val)->isOld) {
+			remember();
+		}
+	}
+
 	void mark();
 	void unmark();
 
 	bool isMark();
 };
 
+// strings created while a script runs are only interned up to this length, longer ones
+// are compared by their characters instead (see objString::copyRuntimeString)
+#define STRING_INTERN_LIMIT 128
+
+// slices at least this long share the characters of the sliced string instead of copying them (see objString::createView)
+#define STRING_VIEW_MIN 32
+
 class objString : public obj {
 public:
 	friend class memoryManager;
 
+	// the characters are stored right behind the object, in the same allocation (see memoryManager::allocateString).
+	// a view points into the characters of its parent, so they aren't terminated by a 0, always use len
 	char* chars;
 	unsigned int len;
 
+	// the string a view shares its characters with, the GC keeps it alive. nullptr if the characters are its own
+	objString* parent = nullptr;
+	// the hash of the characters, computed when the string is interned or when it's first needed
+	uint32_t hash = 0;
+	bool hashed = false;
+
+	// whether this is the only string with these characters. strings created with createString aren't,
+	// so two strings are only equal by identity if both are interned
+	bool interned = false;
+
+	// a small number identifying the string as a method name of the built-in types,
+	// NO_SYMBOL until it gets one (see objClass::indexBySymbol)
+	uint32_t symbol = NO_SYMBOL;
+	static inline uint32_t symbolCount = 0;
+
+	inline uint32_t getSymbol() {
+		if (symbol == NO_SYMBOL) {
+			symbol = symbolCount++;
+		}
+		return symbol;
+	}
+
+	inline uint32_t getHash() {
+		if (!hashed) {
+			hash = hashChars(chars, len);
+			hashed = true;
+		}
+		return hash;
+	}
+
+	static inline bool equal(objString* a, objString* b) {
+		if (a == b) {
+			return true;
+		}
+		if ((a->interned && b->interned) || a->len != b->len || a->getHash() != b->getHash()) {
+			return false;
+		}
+		return memcmp(a->chars, b->chars, a->len) == 0;
+	}
 
-	void init(const char* ch, unsigned int strlen);
+	// FNV-1a, continuing from hash to hash the characters of several parts
+	static inline uint32_t hashChars(const char* chars, size_t length, uint32_t hash = 2166136261u) {
+		for (size_t i = 0; i < length; i++) {
+			hash ^= (unsigned char)chars[i];
+			hash *= 16777619u;
+		}
+		return hash;
+	}
 
 	objString();
 
@@ -64,9 +150,20 @@ public:
 
 	const char* getChars() const;
 
+	// the interned string with these characters, used for identifiers and constants
 	static objString* copyString(const char* chars, const unsigned int len);
+	// a new string that isn't interned, so creating it doesn't hash the characters. for transient results like file contents
+	static objString* createString(const char* chars, const unsigned int len);
+	// interned if it is at most STRING_INTERN_LIMIT long, for strings computed by scripts
+	static objString* copyRuntimeString(const char* chars, const unsigned int len);
 	static objString* copyStringEscape(const char* chars, const unsigned int len);
-	static objString* takeString(char* chars, const unsigned int len);
+	// a view of len characters of str, starting at offset. views are never interned
+	static objString* createView(objString* str, size_t offset, const unsigned int len);
+	// the string with the characters of a followed by the ones of b, interned like copyRuntimeString does
+	static objString* concatenate(objString* a, objString* b);
+	// the string with the characters of all the parts, which are strings whose lengths add up to len.
+	// the parts have to stay reachable, a new string gets allocated
+	static objString* concatenate(const value* parts, size_t count, size_t len);
 };
 
 
@@ -88,6 +185,9 @@ public:
 
 	unsigned char arity;
 
+	// how many stack slots a call needs, including the arguments (see chunk::maxStackDepth)
+	size_t stackSlots = 0;
+
 	objFunction();
 
 	~objFunction() = default;
@@ -153,6 +253,38 @@ public:
 	static objNativeFunction* createNativeFunction(nativeFn fn);
 };
 
+/*
+ * the layout of the fields of instances. instances that got the same fields in the same
+ * order share a shape, which knows the index of every field in objInstance::fields.
+ * adding a field moves an instance along a transition to the next shape, so the shapes
+ * of a class form a tree, owned by the class
+ */
+class shape {
+public:
+	// the slot of every field name. shapes that only ever got fields added share it,
+	// so entries with a slot at or above fieldCount belong to shapes further down the chain
+	std::shared_ptr<flatTable<objString*, uint32_t>> slots;
+	uint32_t fieldCount = 0;
+
+	// the shapes after adding another field, owned by this shape
+	flatTable<objString*, shape*> transitions;
+
+	shape();
+
+	~shape();
+
+	// the slot of the field, or -1 if instances of this shape don't have it
+	inline long find(objString* name) const {
+		auto slot = slots->find(name);
+		if (slot == slots->end() || slot->second >= fieldCount)
+			return -1;
+		return slot->second;
+	}
+
+	// the shape after adding a field, that isn't part of this shape yet
+	shape* addField(objString* name);
+};
+
 class objClass : public obj {
 public:
 	friend class memoryManager;
@@ -163,26 +295,64 @@ public:
 
 	objClass* superClass;
 
-	std::unordered_map<objString*, value> table;
+	// the members declared in this class
+	flatTable<objString*, value> table;
+
+	// the members of this class and all its superclasses, so a lookup doesn't depend on the depth
+	// of the hierarchy. it is rebuilt after a class that was already inherited from changed
+	mutable flatTable<objString*, value> methods;
+	mutable size_t flattenedAt = 0;
+	bool hasSubclasses = false;
+
+	// the members indexed by the symbols of their names, only for classes of built-in types
+	std::vector<value> symbolMethods;
+	bool symbolIndexed = false;
+
+	// the empty shape all shapes of this class's instances descend from
+	shape* rootShape;
+	// the shape new instances start with, it has a field for every member variable
+	shape* initialShape;
+	std::vector<value> initialFields;
+
+	// changes whenever a method table or superclass of any class changes, which invalidates all inline caches
+	static inline size_t generation = 1;
+	// changes whenever a class with subclasses changes, which makes the flattened tables rebuild
+	static inline size_t hierarchyGeneration = 0;
 
 	objClass();
 
-	~objClass() = default;
+	~objClass();
 
 	objString* getName() const;
 
 	void tableSet(objString* n, value val);
 
+	// gives every new instance the field, set to val
+	void addMemberVariable(objString* n, value val);
+
 	inline value tableGet(objString* k) const {
-		if (table.count(k) == 0) {
-			if (superClass != nullptr) {
-				return superClass->tableGet(k);
-			}
+		if (flattenedAt != hierarchyGeneration) {
+			flatten();
+		}
 
+		auto member = methods.find(k);
+		if (member == methods.end()) {
 			return NIL_VAL;
 		}
+		return member->second;
+	}
 
-		return table.at(k);
+	// copies the flattened table of the superclass down and adds the own members
+	void flatten() const;
+
+	// gives every member name a symbol and keeps symbolMethods up to date from now on
+	void indexBySymbol();
+
+	inline value symbolGet(const objString* k) const {
+		if (k->symbol >= symbolMethods.size()) {
+			return NIL_VAL;
+		}
+		return symbolMethods[k->symbol];
 	}
 
 	value superTableGet(objString* k) const;
@@ -202,25 +372,41 @@ public:
 
 	objClass* klass;
 
-	std::unordered_map<objString*, value> table;
+	shape* layout;
+	// indexed by the slots of the shape. a deleted field stays in the shape and holds UNDEFINED_VAL
+	std::vector<value> fields;
 
 	objInstance();
 
 	~objInstance() = default;
 
 	inline void tableSet(objString* n, value val) {
-		table.insert_or_assign(n, val);
+		writeBarrier(val);
+		long slot = layout->find(n);
+		if (slot >= 0) {
+			fields[slot] = val;
+			return;
+		}
+		// the new shape keeps the name, and the shapes belong to the class
+		klass->writeBarrier(n);
+		layout = layout->addField(n);
+		fields.push_back(val);
 	}
 
+	// fields shadow the members of the class
 	inline value tableGet(objString* k) {
-		if (table.count(k) == 0) {
-			return klass->tableGet(k);
+		long slot = layout->find(k);
+		if (slot >= 0 && !IS_UNDEFINED(fields[slot])) {
+			return fields[slot];
 		}
-		return table.at(k);
+		return klass->tableGet(k);
 	}
 
 	inline void tableDelete(objString* k) {
-		table.erase(k);
+		long slot = layout->find(k);
+		if (slot >= 0) {
+			fields[slot] = UNDEFINED_VAL;
+		}
 	}
 
 	static objInstance* createInstance(objClass* kl);
@@ -249,6 +435,10 @@ class objList : public obj {
 public:
 	std::vector<value> data;
 
+	// while the list is remembered, only the elements from this index on can hold young objects
+	// the old list didn't reference before, a minor collection doesn't trace the ones in front of it
+	size_t rememberedFrom = 0;
+
 	objList();
 
 	~objList() = default;
@@ -256,16 +446,92 @@ public:
 	inline size_t getSize() { return data.size(); }
 
 	inline value getValueAt(size_t index) { return data.at(index); }
-	inline void setValueAt(size_t index, value val) { data.at(index) = val; }
+	inline void setValueAt(size_t index, value val) {
+		elementBarrier(index, val);
+		data.at(index) = val;
+	}
+
+	// the write barrier for storing val at index, lists use it instead of writeBarrier
+	inline void elementBarrier(size_t index, value val) {
+		if (isOld && IS_OBJ(val) && AS_OBJ(val)->isYoung()) {
+			if (!isRemembered) {
+				remember();
+				rememberedFrom = index;
+			}
+			else if (index < rememberedFrom) {
+				rememberedFrom = index;
+			}
+		}
+	}
+
+	// has to be called when the elements from index on moved to other indices
+	inline void elementsMoved(size_t index) {
+		if (isRemembered && index < rememberedFrom) {
+			rememberedFrom = index;
+		}
+	}
 
 	void appendValue(value val);
 
 	static objList* createList();
 };
 
-struct myMapHash {
-	size_t operator()(const value& rhs) const {
-		return AS_HASH(rhs);
+// hashes dictionary keys, keys that are equal by valueEqual get the same hash.
+// numbers hash by their numeric value, strings by their characters, other objects by their identity.
+// the result only has to be unique, flatTable mixes it before using it
+struct valueHash {
+	size_t operator()(const value& key) const {
+		if (IS_SMALL_INT(key)) {
+			return uint64_t(int64_t(AS_SMALL_INT(key)));
+		}
+		if (IS_NUM(key)) {
+			double number = AS_NUM(key);
+			// integral doubles hash like the integer, so 1 and 1.0 and also 0.0 and -0.0 are the same key
+			if (number >= -9.2e18 && number <= 9.2e18 && number == double((int64_t)number)) {
+				return uint64_t((int64_t)number);
+			}
+			if (number != number) {
+				return UINT64_MAX;
+			}
+			// the low bits of the mantissa are often zero, fold the upper half into them
+			uint64_t bits;
+			memcpy(&bits, &number, sizeof(bits));
+			return bits ^ (bits >> 32);
+		}
+		if (IS_STR(key)) {
+			return AS_STR(key)->getHash();
+		}
+		if (IS_OBJ(key)) {
+			return (uint64_t)AS_OBJ(key);
+		}
+		if (IS_BOOL(key)) {
+			return AS_BOOL(key) ? 3 : 2;
+		}
+		return 1;
+	}
+};
+
+// compares dictionary keys like VM::areEqual does, except that NaN keys are equal,
+// so a value stored under NaN can be read again
+struct valueEqual {
+	bool operator()(const value& a, const value& b) const {
+		if (IS_SMALL_INT(a) && IS_SMALL_INT(b)) {
+			return AS_SMALL_INT(a) == AS_SMALL_INT(b);
+		}
+		if (IS_NUM(a) && IS_NUM(b)) {
+			double x = AS_NUM(a), y = AS_NUM(b);
+			return x == y || (x != x && y != y);
+		}
+		if (IS_STR(a) && IS_STR(b)) {
+			return objString::equal(AS_STR(a), AS_STR(b));
+		}
+		if (IS_OBJ(a) && IS_OBJ(b)) {
+			return AS_OBJ(a) == AS_OBJ(b);
+		}
+		if (IS_BOOL(a) && IS_BOOL(b)) {
+			return AS_BOOL(a) == AS_BOOL(b);
+		}
+		return IS_NIL(a) && IS_NIL(b);
 	}
 };
 
@@ -274,7 +540,8 @@ class objMap : public obj {
 	friend class memoryManager;
 
 public:
-	std::unordered_map<value, value, myMapHash> data;
+	// iterates in insertion order
+	orderedTable<value, value, valueHash, valueEqual> data;
 
 	objMap();
 
@@ -284,7 +551,8 @@ public:
 
 	value getValueAt(const value key);
 
-	void insertElement(const value key, const value val);
+	// a new key that is a string view is copied, this can collect garbage
+	void insertElement(value key, const value val);
 
 	static objMap* createMap();
 };
@@ -308,4 +576,20 @@ public:
 	static objFile* createWriteFile(objString* path);
 };
 
+// collects the pieces of a string with amortized appends, so building a long string is linear
+class objStringBuilder : public obj {
+	friend class memoryManager;
+
+public:
+	std::string buffer;
+
+	objStringBuilder();
+
+	~objStringBuilder() = default;
+
+	void append(const char* chars, size_t len);
+
+	static objStringBuilder* createStringBuilder();
+};
+
 #endif //SHRIMPP_OBJ_HPP
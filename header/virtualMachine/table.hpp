@@ -0,0 +1,415 @@
+#ifndef SHRIMPP_TABLE_HPP
+#define SHRIMPP_TABLE_HPP
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <utility>
+#include <vector>
+
+// the share of slots a table fills before it doubles, in eighths
+#define TABLE_MAX_LOAD 7
+#define TABLE_INITIAL_CAPACITY 8
+
+// fibonacci hashing, the top bits of the product depend on all bits of the hash,
+// so hashes that only differ in their upper bits (like the bits of doubles) still spread out.
+// the hash is rotated first, so the always zero low bits of aligned pointers don't act like
+// a multiplier with a worse spread. tables take their slot from the top bits
+inline uint64_t mixHash(uint64_t hash) {
+	return std::rotr(hash, 4) * 0x9E3779B97F4A7C15ull;
+}
+
+// the value type of tables only used as a set of keys
+struct noValue {};
+
+struct tableStats {
+	size_t count = 0;
+	size_t capacity = 0;
+	// how many slots a lookup of a present key inspects
+	size_t maxProbe = 0;
+	double averageProbe = 0;
+};
+
+/*
+ * a hash table storing its entries in one flat array (open addressing with linear probing).
+ * the entries are kept in robin hood order: an entry never is further away from the slot its
+ * hash points to than the entry before it, so a lookup stops as soon as it passes the distance
+ * its key would have, and a removal shifts the following entries back instead of leaving a tombstone.
+ * every slot has a control word in a separate array, holding the distance + 1 of its entry
+ * (0 for empty slots) in the upper byte and 8 more bits of the hash in the lower one. probing only
+ * reads that array, and compares a key only if both match, which keeps expensive comparisons rare.
+ *
+ * the hash is mixed by the table, so the identity of a pointer or the bits of a value are fine as hash.
+ * inserting and erasing invalidates iterators, like rehashing an unordered_map does
+ */
+template<typename K, typename V, typename Hash = std::hash<K>, typename Equal = std::equal_to<K>>
+class flatTable {
+public:
+	struct entry {
+		K first;
+		V second;
+	};
+
+	template<typename E>
+	class basicIterator {
+		friend class flatTable;
+
+		E* entries;
+		const uint16_t* controls;
+		size_t index;
+		size_t capacity;
+
+		basicIterator(E* e, const uint16_t* c, size_t i, size_t cap) : entries(e), controls(c), index(i), capacity(cap) {
+			skipEmpty();
+		}
+
+		inline void skipEmpty() {
+			while (index < capacity && controls[index] == 0) {
+				index++;
+			}
+		}
+
+	public:
+		inline E& operator*() const { return entries[index]; }
+		inline E* operator->() const { return &entries[index]; }
+
+		inline basicIterator& operator++() {
+			index++;
+			skipEmpty();
+			return *this;
+		}
+
+		inline bool operator==(const basicIterator& rhs) const { return index == rhs.index; }
+		inline bool operator!=(const basicIterator& rhs) const { return index != rhs.index; }
+	};
+
+	using iterator = basicIterator<entry>;
+	using const_iterator = basicIterator<const entry>;
+
+	inline iterator begin() { return iterator(entries.data(), controls.data(), 0, capacity()); }
+	inline iterator end() { return iterator(entries.data(), controls.data(), capacity(), capacity()); }
+	inline const_iterator begin() const { return const_iterator(entries.data(), controls.data(), 0, capacity()); }
+	inline const_iterator end() const { return const_iterator(entries.data(), controls.data(), capacity(), capacity()); }
+
+	inline size_t size() const { return count; }
+	inline bool empty() const { return count == 0; }
+	inline size_t capacity() const { return controls.size(); }
+
+	inline iterator find(const K& key) {
+		return iterator(entries.data(), controls.data(), findIndex(key), capacity());
+	}
+
+	inline const_iterator find(const K& key) const {
+		return const_iterator(entries.data(), controls.data(), findIndex(key), capacity());
+	}
+
+	/**
+	 * looks up a key by something that isn't a K, like the characters of a string.
+	 * hash has to be what Hash returns for the matching key, equal(probe, key) compares with the stored keys
+	 */
+	template<typename Q, typename QEqual>
+	inline iterator findAs(const Q& probe, size_t hash, QEqual equal) {
+		return iterator(entries.data(), controls.data(), findIndexAs(probe, mixHash(hash), equal), capacity());
+	}
+
+	void insert_or_assign(const K& key, const V& val) {
+		size_t index = findIndex(key);
+		if (index != capacity()) {
+			entries[index].second = val;
+			return;
+		}
+		insert(key, val);
+	}
+
+	// adds an entry without looking for the key first, it must not be in the table yet
+	void insert(const K& key, const V& val) {
+		if ((count + 1) * 8 > capacity() * TABLE_MAX_LOAD) {
+			rehash(capacity() == 0 ? TABLE_INITIAL_CAPACITY : capacity() * 2);
+		}
+		insertNew(entry{ key, val });
+		count++;
+	}
+
+	// \returns the number of removed entries
+	size_t erase(const K& key) {
+		size_t index = findIndex(key);
+		if (index == capacity()) {
+			return 0;
+		}
+		removeAt(index);
+		return 1;
+	}
+
+	/**
+	 * removes every entry the predicate returns true for, without allocating.
+	 * the entries move while the table is walked, so the predicate may see an entry twice
+	 */
+	template<typename Pred>
+	void removeIf(Pred pred) {
+		for (size_t i = 0; i < capacity(); ) {
+			if (controls[i] != 0 && pred(entries[i])) {
+				// the entry after it was shifted into this slot, look at it again
+				removeAt(i);
+			}
+			else {
+				i++;
+			}
+		}
+	}
+
+	void clear() {
+		entries.clear();
+		controls.clear();
+		count = 0;
+		shift = 64;
+	}
+
+	tableStats probeStats() const {
+		tableStats stats;
+		stats.count = count;
+		stats.capacity = capacity();
+		size_t total = 0;
+		for (uint16_t control : controls) {
+			size_t distance = control >> 8;
+			if (distance > stats.maxProbe) {
+				stats.maxProbe = distance;
+			}
+			total += distance;
+		}
+		stats.averageProbe = count == 0 ? 0 : double(total) / double(count);
+		return stats;
+	}
+
+private:
+	std::vector<entry> entries;
+	std::vector<uint16_t> controls;
+	size_t count = 0;
+	// 64 - log2(capacity), the number of hash bits below the slot index
+	unsigned int shift = 64;
+
+	// a distance has to fit into the upper byte, and a lookup counting up to it must not wrap around
+	static constexpr uint16_t MAX_DISTANCE = UINT8_MAX - 1;
+	static constexpr uint16_t DISTANCE_ONE = 1 << 8;
+
+	inline uint64_t mixedHash(const K& key) const {
+		return mixHash(uint64_t(Hash{}(key)));
+	}
+
+	inline size_t homeIndex(uint64_t hash) const {
+		return size_t(hash >> shift);
+	}
+
+	// the control word of an entry of the hash at its home slot, the tag are the bits below the index
+	inline uint16_t homeControl(uint64_t hash) const {
+		return DISTANCE_ONE | uint16_t((hash >> (shift - 8)) & 0xff);
+	}
+
+	// the slot of the key, or capacity() if it isn't in the table
+	inline size_t findIndex(const K& key) const {
+		return findIndexAs(key, mixedHash(key), Equal{});
+	}
+
+	template<typename Q, typename QEqual>
+	size_t findIndexAs(const Q& probe, uint64_t hash, QEqual equal) const {
+		if (count == 0) {
+			return capacity();
+		}
+		size_t mask = capacity() - 1;
+		size_t index = homeIndex(hash);
+		// entries further from their home than the key would be can't be followed by it
+		for (uint16_t control = homeControl(hash); controls[index] >= (control & 0xff00); control += DISTANCE_ONE) {
+			if (controls[index] == control && equal(probe, entries[index].first)) {
+				return index;
+			}
+			index = (index + 1) & mask;
+		}
+		return capacity();
+	}
+
+	void insertNew(entry carried) {
+		size_t mask = capacity() - 1;
+		uint64_t hash = mixedHash(carried.first);
+		size_t index = homeIndex(hash);
+		uint16_t control = homeControl(hash);
+		while (controls[index] != 0) {
+			// the richer entry gives its slot to the poorer one and moves on
+			if ((controls[index] >> 8) < (control >> 8)) {
+				std::swap(carried, entries[index]);
+				std::swap(control, controls[index]);
+			}
+			index = (index + 1) & mask;
+			if ((control >> 8) == MAX_DISTANCE) {
+				rehash(capacity() * 2);
+				insertNew(carried);
+				return;
+			}
+			control += DISTANCE_ONE;
+		}
+		entries[index] = carried;
+		controls[index] = control;
+	}
+
+	// backward shift deletion, pulls the following entries one slot closer to their home
+	void removeAt(size_t index) {
+		size_t mask = capacity() - 1;
+		size_t next = (index + 1) & mask;
+		while (controls[next] >= 2 * DISTANCE_ONE) {
+			entries[index] = entries[next];
+			controls[index] = controls[next] - DISTANCE_ONE;
+			index = next;
+			next = (next + 1) & mask;
+		}
+		controls[index] = 0;
+		entries[index] = entry{};
+		count--;
+	}
+
+	void rehash(size_t newCapacity) {
+		std::vector<entry> oldEntries;
+		std::vector<uint16_t> oldControls;
+		oldEntries.swap(entries);
+		oldControls.swap(controls);
+		entries.resize(newCapacity);
+		controls.resize(newCapacity, 0);
+		shift = 64 - std::countr_zero(newCapacity);
+
+		for (size_t i = 0; i < oldControls.size(); i++) {
+			if (oldControls[i] != 0) {
+				insertNew(oldEntries[i]);
+			}
+		}
+	}
+};
+
+/*
+ * a hash table that keeps its entries in insertion order, in one dense array.
+ * a separate array of slots, probed linearly, holds the position of an entry in the dense
+ * array + 1 (0 for empty slots), next to it the top 32 bits of the mixed hash of every entry are kept,
+ * so a lookup rarely compares a key that doesn't match and growing doesn't hash the keys again.
+ * iterating and marking only walk the dense array.
+ *
+ * there is no way to remove a single entry, the tables using it never remove keys
+ */
+template<typename K, typename V, typename Hash = std::hash<K>, typename Equal = std::equal_to<K>>
+class orderedTable {
+public:
+	struct entry {
+		K first;
+		V second;
+	};
+
+	using iterator = typename std::vector<entry>::iterator;
+	using const_iterator = typename std::vector<entry>::const_iterator;
+
+	inline iterator begin() { return entries.begin(); }
+	inline iterator end() { return entries.end(); }
+	inline const_iterator begin() const { return entries.begin(); }
+	inline const_iterator end() const { return entries.end(); }
+
+	inline size_t size() const { return entries.size(); }
+	inline bool empty() const { return entries.empty(); }
+
+	// the entries in insertion order
+	inline const std::vector<entry>& items() const { return entries; }
+
+	inline iterator find(const K& key) {
+		return entries.begin() + findEntry(key, hashOf(key));
+	}
+
+	inline const_iterator find(const K& key) const {
+		return entries.begin() + findEntry(key, hashOf(key));
+	}
+
+	void insert_or_assign(const K& key, const V& val) {
+		uint32_t hash = hashOf(key);
+		size_t position = findEntry(key, hash);
+		if (position != entries.size()) {
+			entries[position].second = val;
+			return;
+		}
+		if ((entries.size() + 1) * 3 > slots.size() * 2) {
+			rehash(slots.empty() ? TABLE_INITIAL_CAPACITY : slots.size() * 2);
+		}
+		entries.push_back(entry{ key, val });
+		hashes.push_back(hash);
+		insertSlot(hash, uint32_t(entries.size()));
+	}
+
+	void clear() {
+		entries.clear();
+		hashes.clear();
+		slots.clear();
+		shift = 32;
+	}
+
+	tableStats probeStats() const {
+		tableStats stats;
+		stats.count = entries.size();
+		stats.capacity = slots.size();
+		size_t total = 0;
+		for (size_t i = 0; i < slots.size(); i++) {
+			if (slots[i] == 0) {
+				continue;
+			}
+			size_t distance = ((i - homeIndex(hashes[slots[i] - 1])) & (slots.size() - 1)) + 1;
+			if (distance > stats.maxProbe) {
+				stats.maxProbe = distance;
+			}
+			total += distance;
+		}
+		stats.averageProbe = entries.empty() ? 0 : double(total) / double(entries.size());
+		return stats;
+	}
+
+private:
+	std::vector<entry> entries;
+	// the hash of every entry, at the same position
+	std::vector<uint32_t> hashes;
+	// the position + 1 of the entry using the slot, 0 if unused
+	std::vector<uint32_t> slots;
+	// 32 - log2(slots.size()), the number of hash bits below the slot index
+	unsigned int shift = 32;
+
+	static inline uint32_t hashOf(const K& key) {
+		return uint32_t(mixHash(uint64_t(Hash{}(key))) >> 32);
+	}
+
+	inline size_t homeIndex(uint32_t hash) const {
+		return size_t(hash >> shift);
+	}
+
+	// the position of the entry of the key, or entries.size() if it isn't in the table
+	size_t findEntry(const K& key, uint32_t hash) const {
+		if (entries.empty()) {
+			return 0;
+		}
+		size_t mask = slots.size() - 1;
+		for (size_t index = homeIndex(hash); slots[index] != 0; index = (index + 1) & mask) {
+			size_t position = slots[index] - 1;
+			if (hashes[position] == hash && Equal{}(entries[position].first, key)) {
+				return position;
+			}
+		}
+		return entries.size();
+	}
+
+	void insertSlot(uint32_t hash, uint32_t slot) {
+		size_t mask = slots.size() - 1;
+		size_t index = homeIndex(hash);
+		while (slots[index] != 0) {
+			index = (index + 1) & mask;
+		}
+		slots[index] = slot;
+	}
+
+	void rehash(size_t newCapacity) {
+		slots.assign(newCapacity, 0);
+		shift = 32 - std::countr_zero(newCapacity);
+		for (size_t i = 0; i < hashes.size(); i++) {
+			insertSlot(hashes[i], uint32_t(i + 1));
+		}
+	}
+};
+
+#endif //SHRIMPP_TABLE_HPP
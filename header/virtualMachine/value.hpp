@@ -28,18 +28,28 @@ union value {
 #define TRUE_VAL value{(BOOL_MASK | 3)}
 #define FALSE_VAL value{(BOOL_MASK | 2)}
 #define NIL_VAL value{(0x7ffe000000000000)}
+// marks a global slot, that was declared but never defined. never visible to scripts
+#define UNDEFINED_VAL value{(0x7ffe000000000001)}
 
 
+// integers, that fit into 32 bits, are stored in the payload of this quiet NaN.
+// they are numbers like the doubles, so AS_NUM converts them when needed
+#define SMALL_INT_MASK ((uint64_t)0x7ffd000000000000)
+
 //macros for creating the different values
 #define OBJ_VAL(ptr) value{(uint64_t)(ptr) | OBJ_MASK}
 #define NUM_VAL(num) value{ .as_double{num}}
+#define SMALL_INT_VAL(num) value{SMALL_INT_MASK | (uint32_t)(int32_t)(num)}
 
 
 
 //macros for checking type of values
-#define IS_NUM(val) (((val.as_uint64) & QNAN) != QNAN)
+#define IS_DOUBLE(val) (((val.as_uint64) & QNAN) != QNAN)
+#define IS_SMALL_INT(val) ((val.as_uint64 & NANISH_MASK) == SMALL_INT_MASK)
+#define IS_NUM(val) isNumber(val)
 
 #define IS_NIL(val) (val.as_uint64 == 0x7ffe000000000000)
+#define IS_UNDEFINED(val) (val.as_uint64 == 0x7ffe000000000001)
 #define IS_BOOL(val) ((val.as_uint64 & BOOL_MASK) == BOOL_MASK)
 
 #define IS_OBJ(val) ((val.as_uint64 & NANISH_MASK) ==  OBJ_MASK)
@@ -49,16 +59,19 @@ union value {
 #define IS_CLOSURE(val) (IS_OBJ(val) && AS_OBJ(val)->getType() == OBJ_CLOSURE)
 #define IS_INSTANCE(val) (IS_OBJ(val) && AS_OBJ(val)->getType() == OBJ_INSTANCE)
 #define IS_ARRAY(val) (IS_OBJ(val) && AS_OBJ(val)->getType() == OBJ_LIST)
+#define IS_MAP(val) (IS_OBJ(val) && AS_OBJ(val)->getType() == OBJ_MAP)
 #define IS_FILE(val) (IS_OBJ(val) && AS_OBJ(val)->getType() == OBJ_FILE)
+#define IS_STRING_BUILDER(val) (IS_OBJ(val) && AS_OBJ(val)->getType() == OBJ_STRING_BUILDER)
 
 // macro for testing if number is an integer
 
-#define IS_INT(val) (IS_NUM(val) && ((val.as_double) == ((long long)(val.as_double))))
+#define IS_INT(val) isInteger(val)
 
-#define AS_INT(val) ((long long)(val.as_double))
+#define AS_INT(val) asInteger(val)
 
 //macros for pulling data out of values
-#define AS_NUM(val) (val.as_double)
+#define AS_NUM(val) asNumber(val)
+#define AS_SMALL_INT(val) ((int32_t)(uint32_t)val.as_uint64)
 #define AS_BOOL(val) ((bool)(val.as_uint64 & 0x1))
 #define AS_OBJ(val) ((obj*)(val.as_uint64 & 0xFFFFFFFFFFFF))
 #define AS_STR(val) ((objString*)AS_OBJ(val))
@@ -66,6 +79,29 @@ union value {
 
 #define AS_HASH(val) (val.as_uint64)
 
+inline bool isNumber(value val) {
+    return IS_DOUBLE(val) || IS_SMALL_INT(val);
+}
+
+inline double asNumber(value val) {
+    return IS_SMALL_INT(val) ? double(AS_SMALL_INT(val)) : val.as_double;
+}
+
+inline bool isInteger(value val) {
+    return IS_SMALL_INT(val) || (IS_DOUBLE(val) && val.as_double == (long long)val.as_double);
+}
+
+inline long long asInteger(value val) {
+    return IS_SMALL_INT(val) ? AS_SMALL_INT(val) : (long long)val.as_double;
+}
+
+// a small int, if the integer fits into one, otherwise a double
+inline value integerValue(long long num) {
+    if (num == (int32_t)num)
+        return SMALL_INT_VAL(num);
+    return NUM_VAL(double(num));
+}
+
 std::ostream& operator<<(std::ostream& os, const value val);
 
 bool operator==(const value a, const value b);
@@ -76,15 +112,22 @@ const std::string stringify(value val);
 #define TRUE_VAL value(true)
 #define FALSE_VAL value(false)
 #define NIL_VAL value()
+#define UNDEFINED_VAL value(VAL_UNDEFINED)
 #define OBJ_VAL(ptr) value(ptr)
 #define RET_VAL(ptr) value(ptr)
 #define NUM_VAL(num) value(num)
+// without NAN_BOXING all numbers are doubles
+#define SMALL_INT_VAL(num) value(double(num))
 
 //macros for checking type of values
 #define IS_NUM(val) (val.getType() == VAL_NUM)
+#define IS_DOUBLE(val) IS_NUM(val)
+#define IS_SMALL_INT(val) false
+#define AS_SMALL_INT(val) int32_t(0)
 #define IS_INT(val) (IS_NUM(val) && AS_NUM(val) == AS_INT(val))
 
 #define IS_NIL(val) (val.getType() == VAL_NIL)
+#define IS_UNDEFINED(val) (val.getType() == VAL_UNDEFINED)
 #define IS_BOOL(val) (val.getType() == VAL_BOOL)
 
 #define IS_OBJ(val) (val.getType() == VAL_OBJ)
@@ -93,8 +136,10 @@ const std::string stringify(value val);
 #define IS_FUN(val) (IS_OBJ(val) && AS_OBJ(val)->getType() == OBJ_FUN)
 #define IS_CLOSURE(val) (IS_OBJ(val) && AS_OBJ(val)->getType() == OBJ_CLOSURE)
 #define IS_FILE(val) (IS_OBJ(val) && AS_OBJ(val)->getType() == OBJ_FILE)
+#define IS_STRING_BUILDER(val) (IS_OBJ(val) && AS_OBJ(val)->getType() == OBJ_STRING_BUILDER)
 #define IS_INSTANCE(val) (IS_OBJ(val) && AS_OBJ(val)->getType() == OBJ_INSTANCE)
 #define IS_ARRAY(val) (IS_OBJ(val) && AS_OBJ(val)->getType() == OBJ_LIST)
+#define IS_MAP(val) (IS_OBJ(val) && AS_OBJ(val)->getType() == OBJ_MAP)
 
 #define AS_NUM(val) (val.as.number)
 #define AS_BOOL(val) (val.as.boolean)
@@ -116,7 +161,9 @@ enum valType{
     VAL_NUM,
     VAL_BOOL,
     VAL_NIL,
-    VAL_OBJ
+    VAL_OBJ,
+    // marks a global slot, that was declared but never defined
+    VAL_UNDEFINED
 };
 
 union trueVal{
@@ -140,11 +187,15 @@ public:
     explicit value(bool boolean);
     explicit value(double num);
     explicit value(obj* obj);
+    explicit value(valType type);
     inline valType getType() const { return type; };
 
     bool operator==(const value& rhs) const;
 };
 
+inline value integerValue(long long num) {
+    return NUM_VAL(double(num));
+}
 
 //for printing and type function
 const std::string stringify(value val);
@@ -31,6 +31,7 @@ void commandHandler::printHelp()
 		"usage:\n"
 		"\t'shrimpp [path]' to interpret file\n"
 		"\t'shrimpp' to enter repl\n"
+		"\t'shrimpp --vm=reg [path]' to interpret file with the register based VM\n"
 		"\t'shrimpp [option]'\n\n"
 		"options:\n"
 		"\t-help\t\tto print this help text\n"
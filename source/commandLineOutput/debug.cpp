@@ -4,10 +4,15 @@
 
 #include "../../header/virtualMachine/obj.hpp"
 
+#ifdef DEBUG_PROFILE_OPCODES
+#include <algorithm>
+#include <vector>
+#endif
+
 using namespace std;
 
 int debug::constantInstruction(const char *name, chunk *ch, int offset) {
-    short index = (ch->peekByte(offset + 1)) << 8 | ch->peekByte(offset + 2);
+    uint16_t index = ch->readShortAt(offset + 1);
     cout.width(4);
     cout << offset;
     cout.width(20);
@@ -16,21 +21,28 @@ int debug::constantInstruction(const char *name, chunk *ch, int offset) {
     return offset + 3;
 }
 
+int debug::wideConstantInstruction(const char *name, chunk *ch, int offset) {
+    uint32_t index = ch->readIntAt(offset + 1);
+    cout.width(4);
+    cout << offset;
+    cout.width(20);
+    cout << name << " '";
+    cout << ch->getConstant(index) << "'" << endl;
+    return offset + 5;
+}
+
 int debug::appendInstruction(const char* name, chunk* ch, int offset) {
-    size_t numElements = ((size_t(ch->peekByte(offset + 1)) << 56) | (size_t(ch->peekByte(offset + 2)) << 48) |
-        (size_t(ch->peekByte(offset + 3)) << 40) | (size_t(ch->peekByte(offset + 4)) << 32) |
-        (size_t(ch->peekByte(offset + 5)) << 24) | (size_t(ch->peekByte(offset + 6)) << 16) |
-        (size_t(ch->peekByte(offset + 7)) << 8) | size_t(ch->peekByte(offset + 8)));
+    uint32_t numElements = ch->readIntAt(offset + 1);
     cout.width(4);
     cout << offset;
     cout.width(20);
     cout << name;
     cout << numElements << endl;
-    return offset + 9;
+    return offset + 5;
 }
 
 int debug::byteInstruction(const char *name, chunk *ch, int offset) {
-    short index = (ch->peekByte(offset + 1)) << 8 | ch->peekByte(offset + 2);
+    uint16_t index = ch->readShortAt(offset + 1);
     cout.width(4);
     cout << offset;
     cout.width(20);
@@ -48,7 +60,7 @@ int debug::simpleInstruction(const char *name, chunk *ch, int offset) {
 }
 
 int debug::jumpInstruction(const char *name, int sign, chunk *ch, int offset) {
-    short jmpOffset = (ch->peekByte(offset + 1)) << 8 | ch->peekByte(offset + 2);
+    int jmpOffset = ch->readShortAt(offset + 1);
     cout.width(4);
     cout << offset;
     cout.width(20);
@@ -57,6 +69,16 @@ int debug::jumpInstruction(const char *name, int sign, chunk *ch, int offset) {
     return offset + 3;
 }
 
+int debug::wideJumpInstruction(const char *name, int sign, chunk *ch, int offset) {
+    long long jmpOffset = ch->readIntAt(offset + 1);
+    cout.width(4);
+    cout << offset;
+    cout.width(20);
+    cout << name << " ";
+    cout << offset << " -> " << offset + 5 + jmpOffset * sign << endl;
+    return offset + 5;
+}
+
 int debug::callInstruction(const char *name, chunk *ch, int offset) {
     int args = ch->peekByte(offset + 1);
     cout.width(4);
@@ -66,20 +88,105 @@ int debug::callInstruction(const char *name, chunk *ch, int offset) {
     return offset + 2;
 }
 
+int debug::countInstruction(const char *name, chunk *ch, int offset) {
+    int count = ch->peekByte(offset + 1);
+    cout.width(4);
+    cout << offset;
+    cout.width(20);
+    cout << name << " " << count << endl;
+    return offset + 2;
+}
+
 int debug::invokeInstruction(const char* name, chunk* ch, int offset) {
-    short jmpOffset = (ch->peekByte(offset + 1)) << 8 | ch->peekByte(offset + 2);
-    int args = ch->peekByte(offset + 1);
+    uint16_t index = ch->readShortAt(offset + 1);
+    int args = (unsigned char)ch->accessAt(offset + 3);
+    uint16_t cache = ch->readShortAt(offset + 4);
     cout.width(4);
     cout << offset;
     cout.width(20);
-    cout << name << endl;
-    return offset + 4;
+    cout << name << " '" << ch->getConstant(index) << "' (" << args << " args) cache " << cache << endl;
+    return offset + 6;
+}
+
+int debug::cachedConstantInstruction(const char* name, chunk* ch, int offset) {
+    uint16_t index = ch->readShortAt(offset + 1);
+    uint16_t cache = ch->readShortAt(offset + 3);
+    cout.width(4);
+    cout << offset;
+    cout.width(20);
+    cout << name << " '";
+    cout << ch->getConstant(index) << "' cache " << cache << endl;
+    return offset + 5;
+}
+
+int debug::localLocalInstruction(const char* name, chunk* ch, int offset) {
+    uint16_t first = ch->readShortAt(offset + 1);
+    uint16_t second = ch->readShortAt(offset + 3);
+    cout.width(4);
+    cout << offset;
+    cout.width(20);
+    cout << name << " ";
+    cout << first << " " << second << endl;
+    return offset + 5;
+}
+
+int debug::compareJumpInstruction(const char* name, bool constantOperand, chunk* ch, int offset) {
+    uint16_t local = ch->readShortAt(offset + 1);
+    uint16_t second = ch->readShortAt(offset + 3);
+    int jmpOffset = ch->readShortAt(offset + 5);
+    cout.width(4);
+    cout << offset;
+    cout.width(20);
+    cout << name << " ";
+    cout << local << " ";
+    if (constantOperand)
+        cout << "'" << ch->getConstant(second) << "'";
+    else
+        cout << second;
+    cout << " " << offset << " -> " << offset + 7 + jmpOffset << endl;
+    return offset + 7;
+}
+
+// prints a register operand, 'r' followed by the frame slot or the constant
+static void printRegisterOperand(chunk *ch, unsigned short operand) {
+    if (operand & REG_CONSTANT_BIT)
+        cout << "'" << ch->getConstant(operand & ~REG_CONSTANT_BIT) << "'";
+    else
+        cout << "r" << operand;
+}
+
+int debug::registerInstruction(const char* name, int operands, chunk* ch, int offset) {
+    cout.width(4);
+    cout << offset;
+    cout.width(20);
+    cout << name;
+    for (int i = 0; i < operands; i++) {
+        cout << " ";
+        printRegisterOperand(ch, ch->readShortAt(offset + 1 + i * 2));
+    }
+    cout << endl;
+    return offset + 1 + operands * 2;
+}
+
+int debug::registerJumpInstruction(const char* name, chunk* ch, int offset) {
+    int jmpOffset = ch->readShortAt(offset + 5);
+    cout.width(4);
+    cout << offset;
+    cout.width(20);
+    cout << name << " ";
+    printRegisterOperand(ch, ch->readShortAt(offset + 1));
+    cout << " ";
+    printRegisterOperand(ch, ch->readShortAt(offset + 3));
+    cout << " " << offset << " -> " << offset + 7 + jmpOffset << endl;
+    return offset + 7;
 }
 
 int debug::disassembleInstruction(char inst, chunk *ch, int offset) {
     switch (inst) {
         case OP_CONSTANT:
             return constantInstruction("OP_CONSTANT", ch, offset);
+        case OP_CONSTANT_WIDE:
+            return wideConstantInstruction("OP_CONSTANT_WIDE", ch, offset);
         case OP_ADD:
             return simpleInstruction("OP_ADD", ch, offset);
         case OP_SUB:
@@ -90,6 +197,8 @@ int debug::disassembleInstruction(char inst, chunk *ch, int offset) {
             return simpleInstruction("OP_DIV", ch, offset);
         case OP_MODULO:
             return simpleInstruction("OP_MODULO", ch, offset);
+        case OP_CONCAT_N:
+            return countInstruction("OP_CONCAT_N", ch, offset);
         case OP_NEGATE:
             return simpleInstruction("OP_NEGATE", ch, offset);
         case OP_NOT:
@@ -128,16 +237,16 @@ int debug::disassembleInstruction(char inst, chunk *ch, int offset) {
         case OP_BIT_XOR:
             return simpleInstruction("OP_BIT_XOR", ch, offset);
         case OP_DEFINE_GLOBAL:
-            return constantInstruction("OP_DEFINE_GLOBAL", ch, offset);
+            return byteInstruction("OP_DEFINE_GLOBAL", ch, offset);
         case OP_GET_GLOBAL:
-            return constantInstruction("OP_GET_GLOBAL", ch, offset);
+            return byteInstruction("OP_GET_GLOBAL", ch, offset);
         case OP_SET_GLOBAL:
-            return constantInstruction("OP_SET_GLOBAL", ch, offset);
+            return byteInstruction("OP_SET_GLOBAL", ch, offset);
         case OP_GET_LOCAL:
             return byteInstruction("OP_GET_LOCAL", ch, offset);
         case OP_CLOSURE: {
-            offset++;
-            short index = (ch->peekByte(offset++)) << 8 | ch->peekByte(offset++);
+            uint16_t index = ch->readShortAt(offset + 1);
+            offset += 3;
             objFunction* func = (objFunction*)AS_OBJ(ch->getConstant(index));
             cout.width(4);
             cout << offset - 3;
@@ -162,9 +271,9 @@ int debug::disassembleInstruction(char inst, chunk *ch, int offset) {
         case OP_CLOSE_UPVALUE:
             return simpleInstruction("OP_CLOSE_UPVALUE", ch, offset);
         case OP_SET_PROPERTY:
-            return constantInstruction("OP_SET_PROPERTY", ch, offset);
+            return cachedConstantInstruction("OP_SET_PROPERTY", ch, offset);
         case OP_GET_PROPERTY:
-            return constantInstruction("OP_GET_PROPERTY", ch, offset);
+            return cachedConstantInstruction("OP_GET_PROPERTY", ch, offset);
         case OP_SET_LOCAL:
             return byteInstruction("OP_SET_LOCAL", ch, offset);
         case OP_POP:
@@ -173,14 +282,22 @@ int debug::disassembleInstruction(char inst, chunk *ch, int offset) {
             return simpleInstruction("OP_LIST", ch, offset);
         case OP_JUMP:
             return jumpInstruction("OP_JUMP", 1, ch, offset);
+        case OP_JUMP_WIDE:
+            return wideJumpInstruction("OP_JUMP_WIDE", 1, ch, offset);
         case OP_JUMP_IF_FALSE:
             return jumpInstruction("OP_JUMP_IF_FALSE", 1, ch, offset);
+        case OP_JUMP_IF_FALSE_WIDE:
+            return wideJumpInstruction("OP_JUMP_IF_FALSE_WIDE", 1, ch, offset);
         case OP_LOOP:
             return jumpInstruction("OP_LOOP", -1, ch, offset);
+        case OP_LOOP_WIDE:
+            return wideJumpInstruction("OP_LOOP_WIDE", -1, ch, offset);
         // case OP_FUNCTION:
             // return constantInstruction("OP_FUNCTION", ch, offset);
         case OP_CALL:
             return callInstruction("OP_CALL", ch, offset);
+        case OP_TAIL_CALL:
+            return callInstruction("OP_TAIL_CALL", ch, offset);
         case OP_CLASS:
             return constantInstruction("OP_CLASS", ch, offset);
         case OP_METHOD:
@@ -191,6 +308,10 @@ int debug::disassembleInstruction(char inst, chunk *ch, int offset) {
             return invokeInstruction("OP_INVOKE", ch, offset);
         case OP_APPEND:
             return appendInstruction("OP_APPEND", ch, offset);
+        case OP_MAP:
+            return simpleInstruction("OP_MAP", ch, offset);
+        case OP_MAP_APPEND:
+            return appendInstruction("OP_MAP_APPEND", ch, offset);
         case OP_GET_INDEX:
             return simpleInstruction("OP_GET_INDEX", ch, offset);
         case OP_SET_INDEX:
@@ -203,6 +324,50 @@ int debug::disassembleInstruction(char inst, chunk *ch, int offset) {
             return simpleInstruction("OP_INHERIT", ch, offset);
         case OP_SUPER_INVOKE:
             return invokeInstruction("OP_SUPER_INVOKE", ch, offset);
+        case OP_ADD_LOCAL_LOCAL:
+            return localLocalInstruction("OP_ADD_LOCAL_LOCAL", ch, offset);
+        case OP_LESS_LOCAL_CONST_JUMP:
+            return compareJumpInstruction("OP_LESS_LOCAL_CONST_JUMP", true, ch, offset);
+        case OP_LESS_LOCAL_LOCAL_JUMP:
+            return compareJumpInstruction("OP_LESS_LOCAL_LOCAL_JUMP", false, ch, offset);
+        case OP_LESS_EQUAL_LOCAL_LOCAL_JUMP:
+            return compareJumpInstruction("OP_LESS_EQUAL_LOCAL_LOCAL_JUMP", false, ch, offset);
+        case OP_GET_PROPERTY_THIS:
+            return cachedConstantInstruction("OP_GET_PROPERTY_THIS", ch, offset);
+        case OP_SET_LOCAL_POP:
+            return byteInstruction("OP_SET_LOCAL_POP", ch, offset);
+        case OP_ADD_NUM:
+            return simpleInstruction("OP_ADD_NUM", ch, offset);
+        case OP_ADD_STR:
+            return simpleInstruction("OP_ADD_STR", ch, offset);
+        case OP_REG_MOVE:
+            return registerInstruction("OP_REG_MOVE", 2, ch, offset);
+        case OP_REG_SET_TOP:
+            return byteInstruction("OP_REG_SET_TOP", ch, offset);
+        case OP_REG_ADD:
+            return registerInstruction("OP_REG_ADD", 3, ch, offset);
+        case OP_REG_SUB:
+            return registerInstruction("OP_REG_SUB", 3, ch, offset);
+        case OP_REG_MUL:
+            return registerInstruction("OP_REG_MUL", 3, ch, offset);
+        case OP_REG_DIV:
+            return registerInstruction("OP_REG_DIV", 3, ch, offset);
+        case OP_REG_MODULO:
+            return registerInstruction("OP_REG_MODULO", 3, ch, offset);
+        case OP_REG_JUMP_IF_NOT_LESSER:
+            return registerJumpInstruction("OP_REG_JUMP_IF_NOT_LESSER", ch, offset);
+        case OP_REG_JUMP_IF_NOT_LESSER_OR_EQUALS:
+            return registerJumpInstruction("OP_REG_JUMP_IF_NOT_LESSER_OR_EQUALS", ch, offset);
+        case OP_REG_JUMP_IF_NOT_GREATER:
+            return registerJumpInstruction("OP_REG_JUMP_IF_NOT_GREATER", ch, offset);
+        case OP_REG_JUMP_IF_NOT_GREATER_OR_EQUALS:
+            return registerJumpInstruction("OP_REG_JUMP_IF_NOT_GREATER_OR_EQUALS", ch, offset);
+        case OP_REG_JUMP_IF_NOT_EQUALS:
+            return registerJumpInstruction("OP_REG_JUMP_IF_NOT_EQUALS", ch, offset);
+        case OP_REG_JUMP_IF_NOT_NOT_EQUALS:
+            return registerJumpInstruction("OP_REG_JUMP_IF_NOT_NOT_EQUALS", ch, offset);
+        case OP_REG_RETURN:
+            return registerInstruction("OP_REG_RETURN", 1, ch, offset);
         case OP_IMPORT:
             return simpleInstruction("OP_IMPORT", ch, offset);
         case OP_INCREMENT_GLOBAL:
@@ -226,3 +391,232 @@ void debug::disassembleChunk(chunk *ch) {
         offset = disassembleInstruction(ch->accessAt(offset), ch, offset);
     }
 }
+
+
+const char* debug::opcodeName(unsigned char inst) {
+    switch (inst) {
+        case OP_CONSTANT:
+            return "OP_CONSTANT";
+        case OP_CONSTANT_WIDE:
+            return "OP_CONSTANT_WIDE";
+        case OP_ADD:
+            return "OP_ADD";
+        case OP_SUB:
+            return "OP_SUB";
+        case OP_MUL:
+            return "OP_MUL";
+        case OP_DIV:
+            return "OP_DIV";
+        case OP_MODULO:
+            return "OP_MODULO";
+        case OP_CONCAT_N:
+            return "OP_CONCAT_N";
+        case OP_NEGATE:
+            return "OP_NEGATE";
+        case OP_NOT:
+            return "OP_NOT";
+        case OP_INCREMENT_GLOBAL:
+            return "OP_INCREMENT_GLOBAL";
+        case OP_DECREMENT_GLOBAL:
+            return "OP_DECREMENT_GLOBAL";
+        case OP_INCREMENT_LOCAL:
+            return "OP_INCREMENT_LOCAL";
+        case OP_DECREMENT_LOCAL:
+            return "OP_DECREMENT_LOCAL";
+        case OP_EQUALS:
+            return "OP_EQUALS";
+        case OP_CASE_COMPARE:
+            return "OP_CASE_COMPARE";
+        case OP_NOT_EQUALS:
+            return "OP_NOT_EQUALS";
+        case OP_LESSER:
+            return "OP_LESSER";
+        case OP_LESSER_OR_EQUALS:
+            return "OP_LESSER_OR_EQUALS";
+        case OP_GREATER:
+            return "OP_GREATER";
+        case OP_GREATER_OR_EQUALS:
+            return "OP_GREATER_OR_EQUALS";
+        case OP_BIT_AND:
+            return "OP_BIT_AND";
+        case OP_BIT_OR:
+            return "OP_BIT_OR";
+        case OP_BIT_SHIFT_LEFT:
+            return "OP_BIT_SHIFT_LEFT";
+        case OP_BIT_SHIFT_RIGHT:
+            return "OP_BIT_SHIFT_RIGHT";
+        case OP_BIT_NOT:
+            return "OP_BIT_NOT";
+        case OP_BIT_XOR:
+            return "OP_BIT_XOR";
+        case OP_TRUE:
+            return "OP_TRUE";
+        case OP_FALSE:
+            return "OP_FALSE";
+        case OP_NIL:
+            return "OP_NIL";
+        case OP_DEFINE_GLOBAL:
+            return "OP_DEFINE_GLOBAL";
+        case OP_POP:
+            return "OP_POP";
+        case OP_GET_GLOBAL:
+            return "OP_GET_GLOBAL";
+        case OP_SET_GLOBAL:
+            return "OP_SET_GLOBAL";
+        case OP_GET_LOCAL:
+            return "OP_GET_LOCAL";
+        case OP_SET_LOCAL:
+            return "OP_SET_LOCAL";
+        case OP_GET_UPVALUE:
+            return "OP_GET_UPVALUE";
+        case OP_SET_UPVALUE:
+            return "OP_SET_UPVALUE";
+        case OP_CLOSE_UPVALUE:
+            return "OP_CLOSE_UPVALUE";
+        case OP_JUMP:
+            return "OP_JUMP";
+        case OP_JUMP_WIDE:
+            return "OP_JUMP_WIDE";
+        case OP_JUMP_IF_FALSE:
+            return "OP_JUMP_IF_FALSE";
+        case OP_JUMP_IF_FALSE_WIDE:
+            return "OP_JUMP_IF_FALSE_WIDE";
+        case OP_LOOP:
+            return "OP_LOOP";
+        case OP_LOOP_WIDE:
+            return "OP_LOOP_WIDE";
+        case OP_CLOSURE:
+            return "OP_CLOSURE";
+        case OP_CALL:
+            return "OP_CALL";
+        case OP_TAIL_CALL:
+            return "OP_TAIL_CALL";
+        case OP_SET_PROPERTY:
+            return "OP_SET_PROPERTY";
+        case OP_GET_PROPERTY:
+            return "OP_GET_PROPERTY";
+        case OP_CLASS:
+            return "OP_CLASS";
+        case OP_INHERIT:
+            return "OP_INHERIT";
+        case OP_MEMBER_VARIABLE:
+            return "OP_MEMBER_VARIABLE";
+        case OP_METHOD:
+            return "OP_METHOD";
+        case OP_INVOKE:
+            return "OP_INVOKE";
+        case OP_LIST:
+            return "OP_LIST";
+        case OP_APPEND:
+            return "OP_APPEND";
+        case OP_GET_INDEX:
+            return "OP_GET_INDEX";
+        case OP_SET_INDEX:
+            return "OP_SET_INDEX";
+        case OP_MAP:
+            return "OP_MAP";
+        case OP_MAP_APPEND:
+            return "OP_MAP_APPEND";
+        case OP_THIS:
+            return "OP_THIS";
+        case OP_SUPER:
+            return "OP_SUPER";
+        case OP_SUPER_INVOKE:
+            return "OP_SUPER_INVOKE";
+        case OP_ADD_LOCAL_LOCAL:
+            return "OP_ADD_LOCAL_LOCAL";
+        case OP_LESS_LOCAL_CONST_JUMP:
+            return "OP_LESS_LOCAL_CONST_JUMP";
+        case OP_LESS_LOCAL_LOCAL_JUMP:
+            return "OP_LESS_LOCAL_LOCAL_JUMP";
+        case OP_LESS_EQUAL_LOCAL_LOCAL_JUMP:
+            return "OP_LESS_EQUAL_LOCAL_LOCAL_JUMP";
+        case OP_GET_PROPERTY_THIS:
+            return "OP_GET_PROPERTY_THIS";
+        case OP_SET_LOCAL_POP:
+            return "OP_SET_LOCAL_POP";
+        case OP_ADD_NUM:
+            return "OP_ADD_NUM";
+        case OP_ADD_STR:
+            return "OP_ADD_STR";
+        case OP_REG_MOVE:
+            return "OP_REG_MOVE";
+        case OP_REG_SET_TOP:
+            return "OP_REG_SET_TOP";
+        case OP_REG_ADD:
+            return "OP_REG_ADD";
+        case OP_REG_SUB:
+            return "OP_REG_SUB";
+        case OP_REG_MUL:
+            return "OP_REG_MUL";
+        case OP_REG_DIV:
+            return "OP_REG_DIV";
+        case OP_REG_MODULO:
+            return "OP_REG_MODULO";
+        case OP_REG_JUMP_IF_NOT_LESSER:
+            return "OP_REG_JUMP_IF_NOT_LESSER";
+        case OP_REG_JUMP_IF_NOT_LESSER_OR_EQUALS:
+            return "OP_REG_JUMP_IF_NOT_LESSER_OR_EQUALS";
+        case OP_REG_JUMP_IF_NOT_GREATER:
+            return "OP_REG_JUMP_IF_NOT_GREATER";
+        case OP_REG_JUMP_IF_NOT_GREATER_OR_EQUALS:
+            return "OP_REG_JUMP_IF_NOT_GREATER_OR_EQUALS";
+        case OP_REG_JUMP_IF_NOT_EQUALS:
+            return "OP_REG_JUMP_IF_NOT_EQUALS";
+        case OP_REG_JUMP_IF_NOT_NOT_EQUALS:
+            return "OP_REG_JUMP_IF_NOT_NOT_EQUALS";
+        case OP_REG_RETURN:
+            return "OP_REG_RETURN";
+        case OP_IMPORT:
+            return "OP_IMPORT";
+        case OP_RETURN:
+            return "OP_RETURN";
+        default:
+            return "UNKNOWN OPCODE";
+    }
+}
+
+#ifdef DEBUG_PROFILE_OPCODES
+
+static size_t opcodePairCounts[256][256];
+static int previousOpcode = -1;
+
+void debug::profileInstruction(unsigned char inst) {
+    if (previousOpcode != -1) {
+        opcodePairCounts[previousOpcode][inst]++;
+    }
+    previousOpcode = inst;
+}
+
+void debug::printOpcodeProfile(size_t maxEntries) {
+    struct pairCount {
+        size_t count;
+        unsigned char first;
+        unsigned char second;
+    };
+
+    std::vector<pairCount> pairs;
+    size_t total = 0;
+    for (int i = 0; i < 256; i++) {
+        for (int j = 0; j < 256; j++) {
+            if (opcodePairCounts[i][j] != 0) {
+                pairs.push_back({ opcodePairCounts[i][j], (unsigned char)i, (unsigned char)j });
+                total += opcodePairCounts[i][j];
+            }
+        }
+    }
+
+    std::sort(pairs.begin(), pairs.end(), [](const pairCount& a, const pairCount& b) { return a.count > b.count; });
+
+    cerr << " == opcode pairs (" << total << " executed) ==" << endl;
+    for (size_t i = 0; i < pairs.size() && i < maxEntries; i++) {
+        cerr.width(12);
+        cerr << pairs[i].count;
+        cerr.width(8);
+        cerr.precision(2);
+        cerr << fixed << (100.0 * pairs[i].count / total) << "%  ";
+        cerr << opcodeName(pairs[i].first) << " -> " << opcodeName(pairs[i].second) << endl;
+    }
+}
+
+#endif
@@ -6,6 +6,8 @@
 #include "../header/defines.hpp"
 
 #include "../header/virtualMachine/VM.hpp"
+#include "../header/peephole.hpp"
+#include "../header/registerCompiler.hpp"
 
 #ifdef DEBUG_PRINT_CODE
 #include "../header/commandLineOutput/debug.hpp"
@@ -118,27 +120,55 @@ void compiler::emitBytes(char a, char b) {
 	currentFunction->funChunk->addByte(b, prevToken.line);
 }
 
+void compiler::emitShort(uint16_t operand) {
+	currentFunction->funChunk->addShort(operand, prevToken.line);
+}
+
+void compiler::emitInt(uint32_t operand) {
+	currentFunction->funChunk->addInt(operand, prevToken.line);
+}
+
+void compiler::emitCache() {
+	size_t index = currentFunction->funChunk->addCache();
+	if (index > UINT16_MAX) {
+		error("too many property accesses in one function");
+	}
+	emitShort(index);
+}
+
 size_t compiler::emitJump(opCodes jmpCode) {
-	emitByte(jmpCode);
-	emitBytes(0xff, 0xff);
-	return currentFunction->funChunk->getSize() - 2;
+	// the distance isn't known yet, so always the wide form. the optimization passes shorten it
+	emitByte(jmpCode == OP_JUMP ? OP_JUMP_WIDE : OP_JUMP_IF_FALSE_WIDE);
+	emitInt(UINT32_MAX);
+	return currentFunction->funChunk->getSize() - 4;
 }
 
 void compiler::emitLoop(size_t loopStart) {
-	emitByte(OP_LOOP);
+	size_t dest = currentFunction->funChunk->getSize() - loopStart + 3;
 
-	int dest = currentFunction->funChunk->getSize() - loopStart + 2;
+	if (dest <= UINT16_MAX) {
+		emitByte(OP_LOOP);
+		emitShort(dest);
+		return;
+	}
 
-	if (dest > UINT16_MAX)
+	dest += 2;
+	if (dest > UINT32_MAX)
 		error("loop body too big");
 
-	emitBytes((short(dest >> 8)) & 0xff, (dest) & 0xff);
+	emitByte(OP_LOOP_WIDE);
+	emitInt(dest);
 }
 
 //expression parsing functions
 
 void compiler::number(bool canAssign, compiler& cmp) {
 	double num = std::strtod(cmp.prevToken.start, nullptr);
+	// whole numbers, that fit, become small ints. the VM keeps them ints while it can
+	if (num >= INT32_MIN && num <= INT32_MAX && num == (int32_t)num) {
+		cmp.currentFunction->funChunk->writeConstant(SMALL_INT_VAL(num), cmp.prevToken.line);
+		return;
+	}
 	cmp.currentFunction->funChunk->writeConstant(NUM_VAL(num), cmp.prevToken.line);
 }
 
@@ -162,13 +192,15 @@ void compiler::unary(bool canAssign, compiler& cmp) {
 
 void compiler::binary(bool canAssign, compiler& cmp) {
 	token opType = cmp.prevToken;
+	if (opType.type == TOKEN_PLUS) {
+		cmp.addition();
+		return;
+	}
+
 	precFuncTableEntry* rule = cmp.getRule(opType);
 	cmp.parsePrec(precedence(rule->prec + 1));
 
 	switch (opType.type) {
-	case TOKEN_PLUS:
-		cmp.emitByte(OP_ADD);
-		break;
 	case TOKEN_MINUS:
 		cmp.emitByte(OP_SUB);
 		break;
@@ -221,6 +253,44 @@ void compiler::binary(bool canAssign, compiler& cmp) {
 	}
 }
 
+/*
+ * a chain like 'a + ":" + b + ":" + c' is compiled as OP_ADDs first. if one of its operands is a
+ * string literal, it most likely builds a string, so the OP_ADDs are removed again and a single
+ * OP_CONCAT_N allocates the result without the strings in between.
+ * other chains keep their OP_ADDs, which get quickened for numbers
+ */
+void compiler::addition() {
+	chunk* ch = currentFunction->funChunk;
+	bool hasLiteral = ch->getSize() >= 3 && isStringConstant(ch->getSize() - 3);
+
+	std::vector<size_t> adds;
+	do {
+		size_t start = ch->getSize();
+		parsePrec(precedence(PREC_TERM + 1));
+		hasLiteral = hasLiteral || isStringConstant(start);
+
+		adds.push_back(ch->getSize());
+		emitByte(OP_ADD);
+	} while (match(TOKEN_PLUS));
+
+	// jumps inside an operand at most target its end, so they stay valid without the OP_ADDs
+	if (hasLiteral && adds.size() >= 2 && adds.size() < UINT8_MAX) {
+		ch->removeBytes(adds);
+		emitBytes(OP_CONCAT_N, char(adds.size() + 1));
+		// a call at the end of the chain was moved and isn't the last instruction anymore
+		lastCallChunk = nullptr;
+	}
+}
+
+bool compiler::isStringConstant(size_t start) {
+	chunk* ch = currentFunction->funChunk;
+	if (ch->getSize() != start + 3 || (unsigned char)ch->accessAt(start) != OP_CONSTANT)
+		return false;
+	// for the left operand, start is only a guess and can be in the middle of an instruction
+	size_t index = ch->readShortAt(start + 1);
+	return index < ch->constants.size() && IS_STR(ch->getConstant(index));
+}
+
 void compiler::literal(bool canAssign, compiler& cmp) {
 	switch (cmp.prevToken.type) {
 	case TOKEN_TRUE:
@@ -402,7 +472,7 @@ void compiler::namedVariable(token name, bool canAssign) {
 		// maybe add inc and dec upvalue?
 	}
 	else {
-		arg = identifierConstant(name);
+		arg = globalSlot(name);
 		getOP = OP_GET_GLOBAL;
 		setOP = OP_SET_GLOBAL;
 
@@ -417,9 +487,9 @@ void compiler::namedVariable(token name, bool canAssign) {
 		std::string constNameStr(name.start, name.len);
 		checkConsts(isConst, setOP, constNameStr);
 		emitByte(getOP);
-		emitBytes((arg >> 8) & 0xff, arg & 0xff);
+		emitShort(arg);
 		emitByte(incOP);
-		emitBytes((arg >> 8) & 0xff, arg & 0xff);
+		emitShort(arg);
 	}
 	else if (canAssign && match(TOKEN_MINUS_MINUS)) {
 		if (getOP == OP_GET_UPVALUE)
@@ -428,9 +498,9 @@ void compiler::namedVariable(token name, bool canAssign) {
 		std::string constNameStr(name.start, name.len);
 		checkConsts(isConst, setOP, constNameStr);
 		emitByte(getOP);
-		emitBytes((arg >> 8) & 0xff, arg & 0xff);
+		emitShort(arg);
 		emitByte(decOP);
-		emitBytes((arg >> 8) & 0xff, arg & 0xff);
+		emitShort(arg);
 	}
 	else if (canAssign && match(TOKEN_EQUALS)) {
 		std::string constNameStr(name.start, name.len);
@@ -438,7 +508,7 @@ void compiler::namedVariable(token name, bool canAssign) {
 
 		expression();
 		emitByte(setOP);
-		emitBytes((arg >> 8) & 0xff, arg & 0xff);
+		emitShort(arg);
 	}
 	else if (canAssign && match(TOKEN_PLUS_EQUALS)) {
 		std::string constNameStr(name.start, name.len);
@@ -446,7 +516,7 @@ void compiler::namedVariable(token name, bool canAssign) {
 
 		//loading variable onto stack
 		emitByte(getOP);
-		emitBytes((arg >> 8) & 0xff, arg & 0xff);
+		emitShort(arg);
 
 		//parsing number
 		expression();
@@ -454,7 +524,7 @@ void compiler::namedVariable(token name, bool canAssign) {
 		emitByte(OP_ADD);
 		//setting variable to addition result
 		emitByte(setOP);
-		emitBytes((arg >> 8) & 0xff, arg & 0xff);
+		emitShort(arg);
 	}
 	else if (canAssign && match(TOKEN_MINUS_EQUALS)) {
 		std::string constNameStr(name.start, name.len);
@@ -462,12 +532,12 @@ void compiler::namedVariable(token name, bool canAssign) {
 
 		//same principle as with adding
 		emitByte(getOP);
-		emitBytes((arg >> 8) & 0xff, arg & 0xff);
+		emitShort(arg);
 
 		expression();
 		emitByte(OP_SUB);
 		emitByte(setOP);
-		emitBytes((arg >> 8) & 0xff, arg & 0xff);
+		emitShort(arg);
 	}
 	else if (canAssign && match(TOKEN_TIMES_EQUALS)) {
 		std::string constNameStr(name.start, name.len);
@@ -475,12 +545,12 @@ void compiler::namedVariable(token name, bool canAssign) {
 
 		//same principle as with adding
 		emitByte(getOP);
-		emitBytes((arg >> 8) & 0xff, arg & 0xff);
+		emitShort(arg);
 
 		expression();
 		emitByte(OP_MUL);
 		emitByte(setOP);
-		emitBytes((arg >> 8) & 0xff, arg & 0xff);
+		emitShort(arg);
 	}
 	else if (canAssign && match(TOKEN_DIVIDE_EQUALS)) {
 		std::string constNameStr(name.start, name.len);
@@ -488,12 +558,12 @@ void compiler::namedVariable(token name, bool canAssign) {
 
 		//same principle as with adding
 		emitByte(getOP);
-		emitBytes((arg >> 8) & 0xff, arg & 0xff);
+		emitShort(arg);
 
 		expression();
 		emitByte(OP_DIV);
 		emitByte(setOP);
-		emitBytes((arg >> 8) & 0xff, arg & 0xff);
+		emitShort(arg);
 	}
 	else if (canAssign && match(TOKEN_MODULO_EQUALS)) {
 		std::string constNameStr(name.start, name.len);
@@ -501,16 +571,16 @@ void compiler::namedVariable(token name, bool canAssign) {
 
 		//same principle as with adding
 		emitByte(getOP);
-		emitBytes((arg >> 8) & 0xff, arg & 0xff);
+		emitShort(arg);
 
 		expression();
 		emitByte(OP_MODULO);
 		emitByte(setOP);
-		emitBytes((arg >> 8) & 0xff, arg & 0xff);
+		emitShort(arg);
 	}
 	else {
 		emitByte(getOP);
-		emitBytes((arg >> 8) & 0xff, arg & 0xff);
+		emitShort(arg);
 	}
 
 }
@@ -533,6 +603,9 @@ void compiler::call(bool canAssign, compiler& cmp) {
 	cmp.consume("expect ')'", TOKEN_PAREN_CLOSE);
 	cmp.emitByte(OP_CALL);
 	cmp.emitByte((opCodes)arity);
+
+	cmp.lastCallChunk = cmp.currentFunction->funChunk;
+	cmp.lastCallEnd = cmp.lastCallChunk->getSize();
 }
 
 void compiler::dot(bool canAssign, compiler& cmp) {
@@ -542,7 +615,8 @@ void compiler::dot(bool canAssign, compiler& cmp) {
 	if (canAssign && cmp.match(TOKEN_EQUALS)) {
 		cmp.expression();
 		cmp.emitByte(OP_SET_PROPERTY);
-		cmp.emitBytes((index >> 8) & 0xff, (index) & 0xff);
+		cmp.emitShort(index);
+		cmp.emitCache();
 	}
 	else if (cmp.match(TOKEN_PAREN_OPEN)) {
 		int argc = 0;
@@ -557,12 +631,14 @@ void compiler::dot(bool canAssign, compiler& cmp) {
 		}
 		cmp.consume("expect ')' after function call", TOKEN_PAREN_CLOSE);
 		cmp.emitByte(OP_INVOKE);
-		cmp.emitBytes((index >> 8) & 0xff, (index) & 0xff);
+		cmp.emitShort(index);
 		cmp.emitByte((opCodes)argc);
+		cmp.emitCache();
 	}
 	else {
 		cmp.emitByte(OP_GET_PROPERTY);
-		cmp.emitBytes((index >> 8) & 0xff, (index) & 0xff);
+		cmp.emitShort(index);
+		cmp.emitCache();
 	}
 }
 
@@ -579,10 +655,7 @@ void compiler::list(bool canAssign, compiler& cmp) {
 
 	if (len != 0) {
 		cmp.emitByte(OP_APPEND);
-		cmp.emitBytes((len >> 56) & 0xff, (len >> 48) & 0xff);
-		cmp.emitBytes((len >> 40) & 0xff, (len >> 32) & 0xff);
-		cmp.emitBytes((len >> 24) & 0xff, (len >> 16) & 0xff);
-		cmp.emitBytes((len >> 8) & 0xff, (len) & 0xff);
+		cmp.emitInt(len);
 	}
 
 	cmp.consume("expect ']' at end of list", TOKEN_SQUARE_CLOSE);
@@ -604,10 +677,7 @@ void compiler::map(bool canAssign, compiler& cmp) {
 
 	if (len != 0) {
 		cmp.emitByte(OP_MAP_APPEND);
-		cmp.emitBytes((len >> 56) & 0xff, (len >> 48) & 0xff);
-		cmp.emitBytes((len >> 40) & 0xff, (len >> 32) & 0xff);
-		cmp.emitBytes((len >> 24) & 0xff, (len >> 16) & 0xff);
-		cmp.emitBytes((len >> 8) & 0xff, (len) & 0xff);
+		cmp.emitInt(len);
 	}
 
 	cmp.consume("expect '}' at end of dictionary", TOKEN_BRACE_CLOSE);
@@ -657,12 +727,13 @@ void compiler::super_key(bool canAssign, compiler& cmp) {
 		}
 		cmp.consume("expect ')' after function call", TOKEN_PAREN_CLOSE);
 		cmp.emitByte(OP_SUPER_INVOKE);
-		cmp.emitBytes((index >> 8) & 0xff, (index) & 0xff);
+		cmp.emitShort(index);
 		cmp.emitByte((opCodes)argc);
+		cmp.emitCache();
 	}
 	else {
 		cmp.emitByte(OP_SUPER);
-		cmp.emitBytes((index >> 8) & 0xff, (index) & 0xff);
+		cmp.emitShort(index);
 	}
 }
 
@@ -689,7 +760,7 @@ void compiler::preCrement(bool canAssign, compiler& cmp) {
 	int var = cmp.resolveLocal(isConst, cmp.currentToken);
 
 	if (var == -1) {
-		var = cmp.identifierConstant(cmp.currentToken);
+		var = cmp.globalSlot(cmp.currentToken);
 
 		std::string constNameStr(cmp.currentToken.start, cmp.currentToken.len);
 
@@ -715,7 +786,7 @@ void compiler::preCrement(bool canAssign, compiler& cmp) {
 		}
 	}
 
-	cmp.emitBytes((var >> 8) & 0xff, var & 0xff);
+	cmp.emitShort(var);
 
 	cmp.expression();
 }
@@ -819,7 +890,7 @@ void compiler::switchStatement() {
 	emitByte(OP_POP);
 	// if last case was right, and they fell through
 	// they jump to this label
-	if (previousCaseJump == 0) {
+	if (previousCaseJump != 0) {
 		patchJump(previousCaseJump);
 	}
 	consume("expected '}' after switch-statement", TOKEN_BRACE_CLOSE);
@@ -841,13 +912,12 @@ void compiler::expressionStatement() {
 
 
 void compiler::patchJump(size_t offset) {
-	int jump = currentFunction->funChunk->getSize() - offset - 2;
+	size_t jump = currentFunction->funChunk->getSize() - offset - 4;
 
-	if (jump > UINT16_MAX)
-		error("loop body too big");
+	if (jump > UINT32_MAX)
+		error("too much code to jump over");
 
-	currentFunction->funChunk->accessAt(offset) = char(short(jump >> 8)) & 0xff;
-	currentFunction->funChunk->accessAt(offset + 1) = char(jump) & 0xff;
+	currentFunction->funChunk->patchIntAt(offset, jump);
 }
 
 void compiler::whileStatement() {
@@ -930,6 +1000,12 @@ void compiler::returnStatement() {
 			error("init method can't return any value - use 'return;' to return early");
 		}
 		expression();
+
+		// a call, that ends right before the return, is in tail position
+		chunk* ch = currentFunction->funChunk;
+		if (lastCallChunk == ch && lastCallEnd == ch->getSize()) {
+			ch->accessAt(lastCallEnd - 2) = OP_TAIL_CALL;
+		}
 	}
 	emitByte(OP_RETURN);
 	consume("expect ';' after return statement", TOKEN_SEMICOLON);
@@ -1093,6 +1169,15 @@ int compiler::identifierConstant(token& name) {
 		name.line);
 }
 
+int compiler::globalSlot(token& name) {
+	size_t slot = vm.globalSlot(objString::copyString(name.start, name.len));
+	if (slot > UINT16_MAX) {
+		error("too many global variables");
+		return 0;
+	}
+	return (int)slot;
+}
+
 void compiler::addLocal(token name, bool isConst) {
 	local tmp;
 	tmp.depth = -1;
@@ -1129,7 +1214,7 @@ unsigned int compiler::parseVariable(const char* msg, bool isConst) {
 	declareVariable(isConst);
 	if (scopeDepth > 0) return 0;
 
-	return identifierConstant(prevToken);
+	return globalSlot(prevToken);
 }
 
 void compiler::markInitialized() {
@@ -1145,7 +1230,7 @@ void compiler::defineVariable(unsigned int global) {
 	}
 
 	emitByte(OP_DEFINE_GLOBAL);
-	emitBytes((global >> 8) & 0xff, global & 0xff);
+	emitShort(global);
 }
 
 void compiler::constDeclaration() {
@@ -1290,7 +1375,7 @@ void compiler::function() {
 	currentFunction = prevFunction;
 
 	emitByte(OP_CLOSURE);
-	emitBytes((fun >> 8) & 0xff, fun & 0xff);
+	emitShort(fun);
 
 	for (int i = 0; i < newFunc->upvalueCount; i++)
 	{
@@ -1305,6 +1390,9 @@ void compiler::function() {
 
 	//fun->setData(jump, argc);
 
+	if (!hadError)
+		optimizeFunction(newFunc);
+
 #ifdef DEBUG_PRINT_CODE
 	std::cout << " == " << name->getChars() << " == " << std::endl;
 	debug::disassembleChunk(newFunc->funChunk);
@@ -1312,6 +1400,16 @@ void compiler::function() {
 #endif
 }
 
+void compiler::optimizeFunction(objFunction* function) {
+	// the passes don't make the stack deeper, so this holds for their output too
+	function->stackSlots = function->getChunkPtr()->maxStackDepth(function->getArity());
+
+	// functions the register backend can't lower keep running as stack code
+	if (vm.backend == BACKEND_REGISTER && registerCompiler::translateFunction(function))
+		return;
+	peephole::optimizeChunk(function->getChunkPtr());
+}
+
 void compiler::functionDeclaration() {
 	if (scopeDepth != 0) {
 		// error("functions can only be declared in top level code");
@@ -1345,7 +1443,7 @@ void compiler::method() {
 	currentPosition = prevPos;
 
 	emitByte(OP_METHOD);
-	emitBytes((constant >> 8) & 0xff, constant & 0xff);
+	emitShort(constant);
 }
 
 void compiler::memberVar() {
@@ -1362,7 +1460,7 @@ void compiler::memberVar() {
 	consume("expect ';' after member variable", TOKEN_SEMICOLON);
 
 	emitByte(OP_MEMBER_VARIABLE);
-	emitBytes((constant >> 8) & 0xff, constant & 0xff);
+	emitShort(constant);
 }
 
 void compiler::classDeclaration() {
@@ -1373,18 +1471,19 @@ void compiler::classDeclaration() {
 	consume("expect class name", TOKEN_IDENTIFIER);
 	token className = prevToken;
 	unsigned int var = identifierConstant(prevToken);
+	unsigned int global = globalSlot(prevToken);
 	declareVariable(false);
 
 
 	emitByte(OP_CLASS);
-	emitBytes((var >> 8) & 0xff, var & 0xff);
+	emitShort(var);
 
 	if (match(TOKEN_COLON)) {
 		expression();
 		emitByte(OP_INHERIT);
 	}
 
-	defineVariable(var);
+	defineVariable(global);
 
 	consume("expect '{' after class name", TOKEN_BRACE_OPEN);
 
@@ -1477,6 +1576,9 @@ objFunction* compiler::compiling(const char* name, char* str) {
 	}
 	emitByte(OP_RETURN);
 
+	if (!hadError)
+		optimizeFunction(currentFunction);
+
 #ifdef DEBUG_PRINT_CODE
 	char* ptr = currentFunction->funChunk->getInstructionPointer();
 	std::cout << " == " << name << " == " << std::endl;
@@ -1,6 +1,7 @@
 #include <iostream>
 
 #include <fstream>
+#include <cstring>
 
 #include "../header/runFile.hpp"
 #include "../header/commandLineOutput/commandHandler.hpp"
@@ -47,11 +48,17 @@ int main(int argc, char** argv) {
 #ifdef DEBUG_LOG_GC
     std::cout << "DEBUG_LOG_GC\n";
 #endif
+#ifdef DEBUG_PROFILE_OPCODES
+    std::cout << "DEBUG_PROFILE_OPCODES\n";
+#endif
+#ifdef DEBUG_TABLE_STATS
+    std::cout << "DEBUG_TABLE_STATS\n";
+#endif
 
 
     if(argc == 1) {
 #ifdef DEBUG_TESTFILE
-        runFile(DEBUG_TESTFILE);
+        runFile(DEBUG_TESTFILE, BACKEND_STACK);
 #else
         repl();
 #endif
@@ -60,9 +67,17 @@ int main(int argc, char** argv) {
             commandHandler print(argv[1]);
             return 0;
         }
-        runFile(argv[1]);
+        runFile(argv[1], BACKEND_STACK);
+    } else if (argc == 3 && strncmp(argv[1], "--vm=", 5) == 0) {
+        if (strcmp(argv[1] + 5, "reg") == 0) {
+            runFile(argv[2], BACKEND_REGISTER);
+        } else if (strcmp(argv[1] + 5, "stack") == 0) {
+            runFile(argv[2], BACKEND_STACK);
+        } else {
+            std::cerr << "unknown vm '" << argv[1] + 5 << "', use 'stack' or 'reg'" << std::endl;
+        }
     } else {
-        std::cerr << "usage: shrimp [path]\nor try: shrimp -h" << std::endl;
+        std::cerr << "usage: shrimp [--vm=stack|reg] [path]\nor try: shrimp -h" << std::endl;
     }
     return 0;
 }
@@ -79,6 +79,7 @@ static value nativeArray_Pop(int arity, value* args, bool& success) {
 
 	value res = arr->data.at(AS_NUM(args[0]));
 
+	arr->elementsMoved(size_t(AS_NUM(args[0])));
 	arr->data.erase(arr->data.begin() + AS_NUM(args[0]));
 
 	return res;
@@ -112,6 +113,8 @@ static value nativeArray_Insert(int arity, value* args, bool& success) {
 
 	auto it = arr->data.begin() + AS_NUM(args[0]);
 	value element = args[1];
+	arr->elementBarrier(size_t(AS_NUM(args[0])), element);
+	arr->elementsMoved(size_t(AS_NUM(args[0])));
 	arr->data.insert(it, element);
 
 	return NUM_VAL(double(arr->getSize()));
@@ -128,7 +131,7 @@ void nativeArrayClass::nativeArrayFunctions(VM& vm)
 	arrayClass->tableSet(objString::copyString("insert", 6), OBJ_VAL(objNativeFunction::createNativeFunction(nativeArray_Insert)));
 	arrayClass->tableSet(objString::copyString("pop", 3), OBJ_VAL(objNativeFunction::createNativeFunction(nativeArray_Pop)));
 
-	vm.arrayClass = arrayClass;
+	vm.defineBuiltinClass(OBJ_LIST, arrayClass);
 	vm.constVector.emplace_back("Array");
-	vm.globals.insert_or_assign(name, OBJ_VAL(arrayClass));
+	vm.defineGlobal(name, OBJ_VAL(arrayClass));
 }
@@ -0,0 +1,119 @@
+#include "../../header/nativeFunctions/nativeDictFunctions.hpp"
+
+#include "../../header/nativeFunctions/nativeFunctions.hpp"
+
+extern memoryManager globalMemory;
+
+static value nativeDict_Init(int arity, value* args, bool& success) {
+	if (arity != 0) {
+		success = false;
+		return nativeFunctions::error("Dict: expected 0 arguments");
+	}
+
+	return OBJ_VAL(objMap::createMap());
+}
+
+static value nativeDict_Len(int arity, value* args, bool& success) {
+	if (arity != 0) {
+		success = false;
+		return nativeFunctions::error("len: expected 0 arguments");
+	}
+
+	value _this = NAT_THIS;
+	if (!IS_MAP(_this)) {
+		success = false;
+		return nativeFunctions::error("len: can only be used on dicts");
+	}
+
+	return NUM_VAL(double(((objMap*)AS_OBJ(_this))->getSize()));
+}
+
+static value nativeDict_Keys(int arity, value* args, bool& success) {
+	if (arity != 0) {
+		success = false;
+		return nativeFunctions::error("keys: expected 0 arguments");
+	}
+
+	value _this = NAT_THIS;
+	if (!IS_MAP(_this)) {
+		success = false;
+		return nativeFunctions::error("keys: can only be used on dicts");
+	}
+	auto* map = (objMap*)AS_OBJ(_this);
+
+	objList* keys = objList::createList();
+	keys->data.reserve(map->getSize());
+	for (auto& el : map->data) {
+		keys->appendValue(el.first);
+	}
+
+	return OBJ_VAL(keys);
+}
+
+static value nativeDict_Values(int arity, value* args, bool& success) {
+	if (arity != 0) {
+		success = false;
+		return nativeFunctions::error("values: expected 0 arguments");
+	}
+
+	value _this = NAT_THIS;
+	if (!IS_MAP(_this)) {
+		success = false;
+		return nativeFunctions::error("values: can only be used on dicts");
+	}
+	auto* map = (objMap*)AS_OBJ(_this);
+
+	objList* values = objList::createList();
+	values->data.reserve(map->getSize());
+	for (auto& el : map->data) {
+		values->appendValue(el.second);
+	}
+
+	return OBJ_VAL(values);
+}
+
+// a list of [key, value] lists
+static value nativeDict_Items(int arity, value* args, bool& success) {
+	if (arity != 0) {
+		success = false;
+		return nativeFunctions::error("items: expected 0 arguments");
+	}
+
+	value _this = NAT_THIS;
+	if (!IS_MAP(_this)) {
+		success = false;
+		return nativeFunctions::error("items: can only be used on dicts");
+	}
+	auto* map = (objMap*)AS_OBJ(_this);
+
+	objList* items = objList::createList();
+	items->data.reserve(map->getSize());
+
+	// creating the pairs can collect garbage, the list isn't on the stack yet
+	globalMemory.temporaryRoots.push_back(items);
+	for (auto& el : map->data) {
+		objList* pair = objList::createList();
+		pair->appendValue(el.first);
+		pair->appendValue(el.second);
+		items->appendValue(OBJ_VAL(pair));
+	}
+	globalMemory.temporaryRoots.pop_back();
+
+	return OBJ_VAL(items);
+}
+
+void nativeDictClass::nativeDictFunctions(VM& vm)
+{
+	objString* name = objString::copyString("Dict", 4);
+	objClass* dictClass = objClass::createObjClass(name);
+
+	dictClass->tableSet(vm.memory.initString, OBJ_VAL(objNativeFunction::createNativeFunction(nativeDict_Init)));
+	dictClass->tableSet(objString::copyString("len", 3), OBJ_VAL(objNativeFunction::createNativeFunction(nativeDict_Len)));
+	dictClass->tableSet(objString::copyString("keys", 4), OBJ_VAL(objNativeFunction::createNativeFunction(nativeDict_Keys)));
+	dictClass->tableSet(objString::copyString("values", 6), OBJ_VAL(objNativeFunction::createNativeFunction(nativeDict_Values)));
+	dictClass->tableSet(objString::copyString("items", 5), OBJ_VAL(objNativeFunction::createNativeFunction(nativeDict_Items)));
+
+	vm.defineBuiltinClass(OBJ_MAP, dictClass);
+	vm.constVector.emplace_back("Dict");
+	vm.defineGlobal(name, OBJ_VAL(dictClass));
+}
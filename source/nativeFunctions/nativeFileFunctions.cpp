@@ -7,6 +7,8 @@
 
 #include <string>
 
+extern memoryManager globalMemory;
+
 static value nativeFile_Init(int arity, value* args, bool& success) {
 	if (arity > 2 || arity == 0) {
 		success = false;
@@ -59,10 +61,9 @@ static value nativeFile_read(int arity, value* args, bool& success) {
 		return nativeFunctions::error("read: file is closed");
 	}
 
-	char* tmp = new char[file->fileSize];
-	file->file.read(tmp, file->fileSize);
-	objString* fileStr = objString::copyString(tmp, file->fileSize);
-	delete[] tmp;
+	// the contents are read straight into a string that isn't interned, so they are never hashed
+	objString* fileStr = globalMemory.allocateString(file->fileSize);
+	file->file.read(fileStr->chars, file->fileSize);
 
 	return OBJ_VAL(fileStr);
 }
@@ -90,7 +91,7 @@ static value nativeFile_getline(int arity, value* args, bool& success) {
 		return NIL_VAL;
 	}
 
-	return OBJ_VAL(objString::copyString(tmp.data(), tmp.size()));
+	return OBJ_VAL(objString::createString(tmp.data(), tmp.size()));
 }
 
 static value nativeFile_close(int arity, value* args, bool& success) {
@@ -143,7 +144,7 @@ static value nativeFile_write(int arity, value* args, bool& success) {
 	}
 
 
-	file->file << str->getChars();
+	file->file.write(str->chars, str->len);
 
 	return NIL_VAL;
 }
@@ -159,7 +160,7 @@ void nativeFileClass::nativeFileFunctions(VM& vm)
 	fileClass->tableSet(objString::copyString("write", 5), OBJ_VAL(objNativeFunction::createNativeFunction(nativeFile_write)));
 	fileClass->tableSet(objString::copyString("getline", 7), OBJ_VAL(objNativeFunction::createNativeFunction(nativeFile_getline)));
 
-	vm.fileClass = fileClass;
-	vm.globals.insert_or_assign(name, OBJ_VAL(fileClass));
+	vm.defineBuiltinClass(OBJ_FILE, fileClass);
+	vm.defineGlobal(name, OBJ_VAL(fileClass));
 	vm.constVector.emplace_back("File");
 }
@@ -4,6 +4,8 @@
 #include "../../header/nativeFunctions/nativeArrayFunctions.hpp"
 #include "../../header/nativeFunctions/nativeMathFunctions.hpp"
 #include "../../header/nativeFunctions/nativeFileFunctions.hpp"
+#include "../../header/nativeFunctions/nativeDictFunctions.hpp"
+#include "../../header/nativeFunctions/nativeStringBuilderFunctions.hpp"
 
 #include "../../header/virtualMachine/value.hpp"
 #include "../../header/virtualMachine/obj.hpp"
@@ -94,6 +96,9 @@ static value native_Type(int argc, value* args, bool& success) {
 		case OBJ_FILE:
 			str = "file";
 			break;
+		case OBJ_STRING_BUILDER:
+			str = "stringbuilder";
+			break;
 		default:
 			str = "unknown";
 			break;
@@ -161,9 +166,9 @@ static value native_Input(int arity, value* args, bool& success) {
 	}
 
 	if(tmp.at(0) == '"' && tmp.at(tmp.size()-1) == '"')
-		return OBJ_VAL(objString::copyString(tmp.data() + 1, tmp.size() - 2));
+		return OBJ_VAL(objString::copyRuntimeString(tmp.data() + 1, tmp.size() - 2));
 
-	return OBJ_VAL(objString::copyString(tmp.data(), tmp.size()));
+	return OBJ_VAL(objString::copyRuntimeString(tmp.data(), tmp.size()));
 }
 
 static value native_Open(int arity, value* args, bool& success) {
@@ -228,17 +233,19 @@ static value native_GC(int arity, value* args, bool& success) {
 }
 
 void nativeFunctions::initNatives(VM& vm) {
-	vm.globals.insert_or_assign(objString::copyString("clock", 5), OBJ_VAL(objNativeFunction::createNativeFunction(nativeClock)));
-	vm.globals.insert_or_assign(objString::copyString("type", 4), OBJ_VAL(objNativeFunction::createNativeFunction(native_Type)));
-	vm.globals.insert_or_assign(objString::copyString("println", 7), OBJ_VAL(objNativeFunction::createNativeFunction(nativePrintLine)));
-	vm.globals.insert_or_assign(objString::copyString("print", 5), OBJ_VAL(objNativeFunction::createNativeFunction(nativePrint)));
-	vm.globals.insert_or_assign(objString::copyString("input", 5), OBJ_VAL(objNativeFunction::createNativeFunction(native_Input)));
-	vm.globals.insert_or_assign(objString::copyString("open", 4), OBJ_VAL(objNativeFunction::createNativeFunction(native_Open)));
-	vm.globals.insert_or_assign(objString::copyString("collectGarbage", 15), OBJ_VAL(objNativeFunction::createNativeFunction(native_GC)));
+	vm.defineGlobal(objString::copyString("clock", 5), OBJ_VAL(objNativeFunction::createNativeFunction(nativeClock)));
+	vm.defineGlobal(objString::copyString("type", 4), OBJ_VAL(objNativeFunction::createNativeFunction(native_Type)));
+	vm.defineGlobal(objString::copyString("println", 7), OBJ_VAL(objNativeFunction::createNativeFunction(nativePrintLine)));
+	vm.defineGlobal(objString::copyString("print", 5), OBJ_VAL(objNativeFunction::createNativeFunction(nativePrint)));
+	vm.defineGlobal(objString::copyString("input", 5), OBJ_VAL(objNativeFunction::createNativeFunction(native_Input)));
+	vm.defineGlobal(objString::copyString("open", 4), OBJ_VAL(objNativeFunction::createNativeFunction(native_Open)));
+	vm.defineGlobal(objString::copyString("collectGarbage", 15), OBJ_VAL(objNativeFunction::createNativeFunction(native_GC)));
 
 	nativeStringClass::nativeStringFunctions(vm);
 	nativeArrayClass::nativeArrayFunctions(vm);
 	nativeFileClass::nativeFileFunctions(vm);
+	nativeDictClass::nativeDictFunctions(vm);
+	nativeStringBuilderClass::nativeStringBuilderFunctions(vm);
 
 	nativeMathClass::nativeMathFunctions(vm);
 }
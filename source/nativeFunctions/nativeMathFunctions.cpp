@@ -75,6 +75,6 @@ void nativeMathClass::nativeMathFunctions(VM& vm)
 	math->tableSet(objString::copyString("ceil", 4), OBJ_VAL(objNativeFunction::createNativeFunction(nativeMath_Ceil)));
 	math->tableSet(objString::copyString("rand", 4), OBJ_VAL(objNativeFunction::createNativeFunction(nativeMath_Rand)));
 
-	vm.globals.insert_or_assign(mathName, OBJ_VAL(math));
+	vm.defineGlobal(mathName, OBJ_VAL(math));
 	vm.constVector.emplace_back("Math");
 }
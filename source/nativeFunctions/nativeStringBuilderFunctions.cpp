@@ -0,0 +1,109 @@
+#include "../../header/nativeFunctions/nativeStringBuilderFunctions.hpp"
+
+#include "../../header/nativeFunctions/nativeFunctions.hpp"
+
+#include <string>
+
+// appends the arguments like print writes them, strings without copying them into a std::string first
+static void appendValues(objStringBuilder* builder, int arity, value* args) {
+	for (int i = 0; i < arity; i++) {
+		if (IS_STR(args[i])) {
+			objString* str = AS_STR(args[i]);
+			builder->append(str->chars, str->len);
+		}
+		else {
+			std::string str = stringify(args[i]);
+			builder->append(str.data(), str.size());
+		}
+	}
+}
+
+static value nativeStringBuilder_Init(int arity, value* args, bool& success) {
+	objStringBuilder* builder = objStringBuilder::createStringBuilder();
+	appendValues(builder, arity, args);
+
+	return OBJ_VAL(builder);
+}
+
+// returns the builder, so appends can be chained
+static value nativeStringBuilder_Append(int arity, value* args, bool& success) {
+	if (arity < 1) {
+		success = false;
+		return nativeFunctions::error("append: expects at least 1 argument");
+	}
+
+	value _this = NAT_THIS;
+	if (!IS_STRING_BUILDER(_this)) {
+		success = false;
+		return nativeFunctions::error("append: can only be used on string builders");
+	}
+
+	appendValues((objStringBuilder*)AS_OBJ(_this), arity, args);
+
+	return _this;
+}
+
+static value nativeStringBuilder_Len(int arity, value* args, bool& success) {
+	if (arity != 0) {
+		success = false;
+		return nativeFunctions::error("len: expected 0 arguments");
+	}
+
+	value _this = NAT_THIS;
+	if (!IS_STRING_BUILDER(_this)) {
+		success = false;
+		return nativeFunctions::error("len: can only be used on string builders");
+	}
+
+	return NUM_VAL(double(((objStringBuilder*)AS_OBJ(_this))->buffer.size()));
+}
+
+// empties the builder, it keeps its buffer for the next string
+static value nativeStringBuilder_Clear(int arity, value* args, bool& success) {
+	if (arity != 0) {
+		success = false;
+		return nativeFunctions::error("clear: expected 0 arguments");
+	}
+
+	value _this = NAT_THIS;
+	if (!IS_STRING_BUILDER(_this)) {
+		success = false;
+		return nativeFunctions::error("clear: can only be used on string builders");
+	}
+
+	((objStringBuilder*)AS_OBJ(_this))->buffer.clear();
+
+	return NIL_VAL;
+}
+
+static value nativeStringBuilder_ToString(int arity, value* args, bool& success) {
+	if (arity != 0) {
+		success = false;
+		return nativeFunctions::error("toString: expected 0 arguments");
+	}
+
+	value _this = NAT_THIS;
+	if (!IS_STRING_BUILDER(_this)) {
+		success = false;
+		return nativeFunctions::error("toString: can only be used on string builders");
+	}
+	auto* builder = (objStringBuilder*)AS_OBJ(_this);
+
+	return OBJ_VAL(objString::copyRuntimeString(builder->buffer.data(), builder->buffer.size()));
+}
+
+void nativeStringBuilderClass::nativeStringBuilderFunctions(VM& vm)
+{
+	objString* name = objString::copyString("StringBuilder", 13);
+	objClass* builderClass = objClass::createObjClass(name);
+
+	builderClass->tableSet(vm.memory.initString, OBJ_VAL(objNativeFunction::createNativeFunction(nativeStringBuilder_Init)));
+	builderClass->tableSet(objString::copyString("append", 6), OBJ_VAL(objNativeFunction::createNativeFunction(nativeStringBuilder_Append)));
+	builderClass->tableSet(objString::copyString("len", 3), OBJ_VAL(objNativeFunction::createNativeFunction(nativeStringBuilder_Len)));
+	builderClass->tableSet(objString::copyString("clear", 5), OBJ_VAL(objNativeFunction::createNativeFunction(nativeStringBuilder_Clear)));
+	builderClass->tableSet(objString::copyString("toString", 8), OBJ_VAL(objNativeFunction::createNativeFunction(nativeStringBuilder_ToString)));
+
+	vm.defineBuiltinClass(OBJ_STRING_BUILDER, builderClass);
+	vm.constVector.emplace_back("StringBuilder");
+	vm.defineGlobal(name, OBJ_VAL(builderClass));
+}
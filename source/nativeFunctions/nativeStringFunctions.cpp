@@ -7,6 +7,8 @@
 
 #include "../../header/virtualMachine/VM.hpp"
 
+extern memoryManager globalMemory;
+
 static value nativeString_Init(int arity, value* args, bool& success) {
 	if (arity != 1) {
 		success = false;
@@ -93,7 +95,11 @@ static value nativeString_Slice(int arity, value* args, bool& success) {
 	}
 
 
-	return OBJ_VAL(objString::copyString(str->getChars() + uint64_t(indexOne), uint64_t(indexTwo - indexOne + 1)));
+	uint64_t sliceLen = uint64_t(indexTwo - indexOne + 1);
+	if (sliceLen >= STRING_VIEW_MIN) {
+		return OBJ_VAL(objString::createView(str, uint64_t(indexOne), sliceLen));
+	}
+	return OBJ_VAL(objString::copyRuntimeString(str->getChars() + uint64_t(indexOne), sliceLen));
 }
 
 static value nativeString_Chr(int arity, value* args, bool& success) {
@@ -131,6 +137,11 @@ static value nativeString_To_String(int arity, value* args, bool& success) {
 	}
 
 	if (IS_NUM((*args))) {
+		double number = AS_NUM((*args));
+		if (number >= 0 && number < SMALL_INT_STRINGS && number == long(number)) {
+			return OBJ_VAL(globalMemory.intStrings[long(number)]);
+		}
+
 		std::string result;
 		if (AS_NUM((*args)) == long(AS_NUM((*args)))) {
 			result = std::to_string(long(AS_NUM((*args))));
@@ -166,10 +177,9 @@ static value nativeString_To_Chr(int arity, value* args, bool& success) {
 		return nativeFunctions::error("to_chr: argument must be a number");
 	}
 
-	char chr[1];
-	chr[0] = AS_NUM((*args));
+	unsigned char chr = (unsigned char)(char)AS_NUM((*args));
 
-	return OBJ_VAL(objString::copyString(chr, 1));
+	return OBJ_VAL(globalMemory.charStrings[chr]);
 }
 
 static value nativeString_At(int arity, value* args, bool& success) {
@@ -201,9 +211,7 @@ static value nativeString_At(int arity, value* args, bool& success) {
 		index += (str->getLen() - 1);
 	}
 
-	char atChar[1] = { str->getChars()[index] };
-
-	return OBJ_VAL(objString::copyString(atChar, 1));
+	return OBJ_VAL(globalMemory.charStrings[(unsigned char)str->getChars()[index]]);
 }
 
 static value nativeString_Number(int arity, value* args, bool& success) {
@@ -218,7 +226,9 @@ static value nativeString_Number(int arity, value* args, bool& success) {
 	}
 	auto str = (objString*)AS_OBJ((_this));
 
-	const char* start = str->getChars();
+	// the characters of a view go on past its end
+	std::string chars(str->chars, str->len);
+	const char* start = chars.c_str();
 
 	if ((start[0] >= '0' && start[0] <= '9') || start[0] == '-') {
 		double res = strtod(start, nullptr);
@@ -233,13 +243,12 @@ void nativeStringClass::nativeStringFunctions(VM& vm)
 	objString* stringClassName = objString::copyString("String", 6);
 	objClass* StringClass = objClass::createObjClass(stringClassName);
 
-	vm.stringClass = StringClass;
 	vm.constVector.emplace_back("String");
 
 	//standalone
-	vm.globals.insert_or_assign(objString::copyString("to_chr", 6), OBJ_VAL(objNativeFunction::createNativeFunction(nativeString_To_Chr)));
-	vm.globals.insert_or_assign(objString::copyString("to_string", 9), OBJ_VAL(objNativeFunction::createNativeFunction(nativeString_To_String)));
-	vm.globals.insert_or_assign(stringClassName, OBJ_VAL(StringClass));
+	vm.defineGlobal(objString::copyString("to_chr", 6), OBJ_VAL(objNativeFunction::createNativeFunction(nativeString_To_Chr)));
+	vm.defineGlobal(objString::copyString("to_string", 9), OBJ_VAL(objNativeFunction::createNativeFunction(nativeString_To_String)));
+	vm.defineGlobal(stringClassName, OBJ_VAL(StringClass));
 
 
 	//tied to string objects
@@ -249,4 +258,6 @@ void nativeStringClass::nativeStringFunctions(VM& vm)
 	StringClass->tableSet(objString::copyString("chr", 3), OBJ_VAL(objNativeFunction::createNativeFunction(nativeString_Chr)));
 	StringClass->tableSet(objString::copyString("at", 2), OBJ_VAL(objNativeFunction::createNativeFunction(nativeString_At)));
 	StringClass->tableSet(objString::copyString("number", 6), OBJ_VAL(objNativeFunction::createNativeFunction(nativeString_Number)));
+
+	vm.defineBuiltinClass(OBJ_STR, StringClass);
 }
@@ -0,0 +1,204 @@
+#include "../header/peephole.hpp"
+
+#include <initializer_list>
+#include <vector>
+
+struct instruction {
+	size_t offset;
+	size_t length;
+	unsigned char op;
+};
+
+static void emitShort(std::vector<char>& code, unsigned short val) {
+	code.resize(code.size() + 2);
+	encodeShort(&code[code.size() - 2], val);
+}
+
+static bool isWideJump(unsigned char op) {
+	return op == OP_JUMP_WIDE || op == OP_JUMP_IF_FALSE_WIDE || op == OP_LOOP_WIDE;
+}
+
+static bool isJump(unsigned char op) {
+	return op == OP_JUMP || op == OP_JUMP_IF_FALSE || op == OP_LOOP || isWideJump(op);
+}
+
+static bool isLoop(unsigned char op) {
+	return op == OP_LOOP || op == OP_LOOP_WIDE;
+}
+
+// the _WIDE opcodes directly follow their 16-bit variant
+static unsigned char narrowJump(unsigned char op) {
+	return isWideJump(op) ? op - 1 : op;
+}
+
+// returns the absolute target of the jump, the fused compare-and-jump ops jump relative to their end
+static long jumpTarget(chunk* ch, const instruction& inst) {
+	size_t offset = isWideJump(inst.op) ? ch->readIntAt(inst.offset + 1) : ch->readShortAt(inst.offset + inst.length - 2);
+	if (isLoop(inst.op))
+		return long(inst.offset + inst.length) - long(offset);
+	return long(inst.offset + inst.length) + long(offset);
+}
+
+void peephole::optimizeChunk(chunk* ch) {
+	std::vector<instruction> insts;
+	size_t size = ch->getSize();
+	for (size_t offset = 0; offset < size;) {
+		instruction inst{ offset, ch->instructionLength(offset), (unsigned char)ch->accessAt(offset) };
+		if (offset + inst.length > size)
+			return;
+		insts.push_back(inst);
+		offset += inst.length;
+	}
+
+	// a fused sequence must not contain a jump target, except for its first instruction
+	std::vector<bool> isStart(size + 1, false);
+	std::vector<bool> isTarget(size + 1, false);
+	for (auto& inst : insts)
+		isStart[inst.offset] = true;
+	isStart[size] = true;
+	for (auto& inst : insts) {
+		if (!isJump(inst.op))
+			continue;
+		long target = jumpTarget(ch, inst);
+		// a jump into the middle of an instruction, leave the chunk as it is
+		if (target < 0 || target > long(size) || !isStart[target])
+			return;
+		isTarget[target] = true;
+	}
+
+	// the code only shrinks, so a wide jump whose offset fits into 16 bits already, keeps fitting
+	std::vector<long> targets(insts.size(), 0);
+	for (size_t i = 0; i < insts.size(); i++) {
+		if (!isJump(insts[i].op))
+			continue;
+		targets[i] = jumpTarget(ch, insts[i]);
+		size_t end = insts[i].offset + insts[i].length;
+		size_t distance = isLoop(insts[i].op) ? end - targets[i] : targets[i] - end;
+		if (distance <= UINT16_MAX)
+			insts[i].op = narrowJump(insts[i].op);
+	}
+
+	auto matches = [&](size_t first, std::initializer_list<unsigned char> ops) {
+		if (first + ops.size() > insts.size())
+			return false;
+		size_t i = first;
+		for (unsigned char op : ops) {
+			if (insts[i].op != op || (i != first && isTarget[insts[i].offset]))
+				return false;
+			i++;
+		}
+		return true;
+	};
+	auto operand = [&](size_t i) { return ch->readShortAt(insts[i].offset + 1); };
+
+	std::vector<char> newCode;
+	std::vector<unsigned int> newLines;
+	std::vector<size_t> newOffset(size + 1, 0);
+	// position of a jump operand in the new code, end of its instruction and old target
+	struct jumpFixup {
+		size_t operandPos;
+		size_t instEnd;
+		long oldTarget;
+		bool backwards;
+		bool wide;
+	};
+	std::vector<jumpFixup> fixups;
+
+	for (size_t i = 0; i < insts.size();) {
+		size_t start = newCode.size();
+		size_t fused = 1;
+		long oldTarget = 0;
+		bool hasJump = false;
+
+		if (matches(i, { OP_GET_LOCAL, OP_INCREMENT_LOCAL, OP_POP }) && operand(i) == operand(i + 1)) {
+			// 'i++;' as a statement, the pushed old value is never used
+			newCode.push_back(OP_INCREMENT_LOCAL);
+			emitShort(newCode, operand(i));
+			fused = 3;
+		}
+		else if (matches(i, { OP_GET_LOCAL, OP_DECREMENT_LOCAL, OP_POP }) && operand(i) == operand(i + 1)) {
+			newCode.push_back(OP_DECREMENT_LOCAL);
+			emitShort(newCode, operand(i));
+			fused = 3;
+		}
+		else if (matches(i, { OP_GET_LOCAL, OP_CONSTANT, OP_LESSER, OP_JUMP_IF_FALSE, OP_POP })) {
+			newCode.push_back(OP_LESS_LOCAL_CONST_JUMP);
+			emitShort(newCode, operand(i));
+			emitShort(newCode, operand(i + 1));
+			emitShort(newCode, 0);
+			oldTarget = targets[i + 3];
+			hasJump = true;
+			fused = 5;
+		}
+		else if (matches(i, { OP_GET_LOCAL, OP_GET_LOCAL, OP_LESSER, OP_JUMP_IF_FALSE, OP_POP })) {
+			newCode.push_back(OP_LESS_LOCAL_LOCAL_JUMP);
+			emitShort(newCode, operand(i));
+			emitShort(newCode, operand(i + 1));
+			emitShort(newCode, 0);
+			oldTarget = targets[i + 3];
+			hasJump = true;
+			fused = 5;
+		}
+		else if (matches(i, { OP_GET_LOCAL, OP_GET_LOCAL, OP_LESSER_OR_EQUALS, OP_JUMP_IF_FALSE, OP_POP })) {
+			newCode.push_back(OP_LESS_EQUAL_LOCAL_LOCAL_JUMP);
+			emitShort(newCode, operand(i));
+			emitShort(newCode, operand(i + 1));
+			emitShort(newCode, 0);
+			oldTarget = targets[i + 3];
+			hasJump = true;
+			fused = 5;
+		}
+		else if (matches(i, { OP_GET_LOCAL, OP_GET_LOCAL, OP_ADD })) {
+			newCode.push_back(OP_ADD_LOCAL_LOCAL);
+			emitShort(newCode, operand(i));
+			emitShort(newCode, operand(i + 1));
+			fused = 3;
+		}
+		else if (matches(i, { OP_THIS, OP_GET_PROPERTY })) {
+			newCode.push_back(OP_GET_PROPERTY_THIS);
+			emitShort(newCode, operand(i + 1));
+			emitShort(newCode, ch->readShortAt(insts[i + 1].offset + 3));
+			fused = 2;
+		}
+		else if (matches(i, { OP_SET_LOCAL, OP_POP })) {
+			newCode.push_back(OP_SET_LOCAL_POP);
+			emitShort(newCode, operand(i));
+			fused = 2;
+		}
+		else if (isJump(insts[i].op)) {
+			newCode.push_back(insts[i].op);
+			newCode.resize(newCode.size() + (isWideJump(insts[i].op) ? 4 : 2));
+			oldTarget = targets[i];
+			hasJump = true;
+		}
+		else {
+			const instruction& inst = insts[i];
+			for (size_t b = 0; b < inst.length; b++)
+				newCode.push_back(ch->accessAt(inst.offset + b));
+		}
+
+		if (hasJump) {
+			bool backwards = isLoop(insts[i].op);
+			bool wide = isWideJump(insts[i].op);
+			fixups.push_back({ newCode.size() - (wide ? 4 : 2), newCode.size(), oldTarget, backwards, wide });
+		}
+		unsigned int line = ch->getLine(insts[i].offset);
+		newLines.resize(newCode.size(), line);
+		for (size_t j = i; j < i + fused; j++)
+			newOffset[insts[j].offset] = start;
+		i += fused;
+	}
+	newOffset[size] = newCode.size();
+
+	// the code only shrinks, so every offset still fits into its operand
+	for (auto& fix : fixups) {
+		size_t target = newOffset[fix.oldTarget];
+		size_t offset = fix.backwards ? fix.instEnd - target : target - fix.instEnd;
+		if (fix.wide)
+			encodeInt(&newCode[fix.operandPos], offset);
+		else
+			encodeShort(&newCode[fix.operandPos], offset);
+	}
+
+	ch->replaceCode(std::move(newCode), std::move(newLines));
+}
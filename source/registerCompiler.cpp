@@ -0,0 +1,460 @@
+#include "../header/registerCompiler.hpp"
+
+#include <vector>
+
+#include "../header/virtualMachine/chunk.hpp"
+#include "../header/virtualMachine/obj.hpp"
+
+namespace {
+
+	enum operandKind {
+		// the value is stored in the frame slot of its stack depth
+		OPERAND_SLOT,
+		// not stored yet, it's the value of a local or a constant
+		OPERAND_LOCAL,
+		OPERAND_CONSTANT
+	};
+
+	struct stackEntry {
+		operandKind kind;
+		size_t index;
+	};
+
+	struct instruction {
+		size_t offset;
+		size_t length;
+		unsigned char op;
+	};
+
+	struct jumpFixup {
+		size_t operandPos;
+		size_t instEnd;
+		size_t oldTarget;
+		bool backwards;
+		bool wide;
+	};
+
+	constexpr size_t NO_POSITION = SIZE_MAX;
+
+	/*
+	 * walks the stack code once and simulates the stack. values pushed by GET_LOCAL
+	 * and CONSTANT are only stored in their slot when needed, so the register
+	 * instructions can name the local or constant directly.
+	 * before every stack instruction, jump and jump target all values are stored
+	 * and the stack pointer of the VM is set to the simulated depth again.
+	 * all slots below the stack pointer always hold valid values for the GC
+	 */
+	class translator {
+		chunk* ch;
+		std::vector<instruction> insts;
+		std::vector<bool> isTarget;
+		std::vector<long> labelDepth;
+		std::vector<size_t> newOffset;
+		std::vector<jumpFixup> fixups;
+
+		std::vector<char> code;
+		std::vector<unsigned int> lines;
+		unsigned int line = 0;
+
+		std::vector<stackEntry> stack;
+		// the depth the stack pointer of the VM points to
+		size_t spDepth = 0;
+
+		// destination operand of the last emitted instruction, if it was an arithmetic one
+		size_t lastDestinationPos = NO_POSITION;
+		size_t lastDestinationSlot = NO_POSITION;
+
+		bool failed = false;
+
+		unsigned short readShortAt(size_t offset) {
+			return ch->readShortAt(offset);
+		}
+
+		static bool isJump(unsigned char op) {
+			return op == OP_JUMP || op == OP_JUMP_WIDE || op == OP_JUMP_IF_FALSE
+				|| op == OP_JUMP_IF_FALSE_WIDE || op == OP_LOOP || op == OP_LOOP_WIDE;
+		}
+
+		static bool isWideJump(unsigned char op) {
+			return op == OP_JUMP_WIDE || op == OP_JUMP_IF_FALSE_WIDE || op == OP_LOOP_WIDE;
+		}
+
+		static bool isLoop(unsigned char op) {
+			return op == OP_LOOP || op == OP_LOOP_WIDE;
+		}
+
+		size_t jumpDistance(const instruction& inst) {
+			return isWideJump(inst.op) ? ch->readIntAt(inst.offset + 1) : readShortAt(inst.offset + 1);
+		}
+
+		size_t jumpTarget(const instruction& inst) {
+			size_t offset = jumpDistance(inst);
+			if (isLoop(inst.op))
+				return inst.offset + inst.length - offset;
+			return inst.offset + inst.length + offset;
+		}
+
+		void emitByte(char byte) {
+			code.push_back(byte);
+			lines.push_back(line);
+			lastDestinationPos = NO_POSITION;
+		}
+
+		void emitShort(size_t val) {
+			if (val > UINT16_MAX)
+				failed = true;
+			char bytes[2];
+			encodeShort(bytes, uint16_t(val));
+			emitByte(bytes[0]);
+			emitByte(bytes[1]);
+		}
+
+		// encodes the value at the given depth as an operand
+		size_t operand(size_t depth) {
+			const stackEntry& entry = stack.at(depth);
+			size_t encoded = entry.kind == OPERAND_SLOT ? depth : entry.index;
+			if (encoded >= REG_CONSTANT_BIT)
+				failed = true;
+			if (entry.kind == OPERAND_CONSTANT)
+				encoded |= REG_CONSTANT_BIT;
+			return encoded;
+		}
+
+		void store(size_t from, size_t to) {
+			for (size_t depth = from; depth < to; depth++) {
+				const stackEntry& entry = stack[depth];
+				if (entry.kind == OPERAND_SLOT)
+					continue;
+				if (depth == spDepth) {
+					// right above the stack pointer, so the old push instruction stores it
+					emitByte(entry.kind == OPERAND_LOCAL ? OP_GET_LOCAL : OP_CONSTANT);
+					emitShort(entry.index);
+					spDepth++;
+				}
+				else {
+					size_t src = operand(depth);
+					emitByte(OP_REG_MOVE);
+					emitShort(depth);
+					emitShort(src);
+				}
+				stack[depth] = { OPERAND_SLOT, depth };
+			}
+		}
+
+		// stores values still referring to the local, before it gets overwritten
+		void storeReferencesTo(size_t local, size_t to) {
+			for (size_t depth = 0; depth < to; depth++) {
+				if (stack[depth].kind == OPERAND_LOCAL && stack[depth].index == local)
+					store(depth, depth + 1);
+			}
+		}
+
+		void syncTop(size_t depth) {
+			if (spDepth == depth)
+				return;
+			emitByte(OP_REG_SET_TOP);
+			emitShort(depth);
+			spDepth = depth;
+		}
+
+		void flush() {
+			store(0, stack.size());
+			syncTop(stack.size());
+		}
+
+		void resetStack(size_t depth) {
+			stack.clear();
+			for (size_t i = 0; i < depth; i++)
+				stack.push_back({ OPERAND_SLOT, i });
+			spDepth = depth;
+		}
+
+		bool mergeDepth(size_t target, size_t depth) {
+			if (labelDepth[target] < 0) {
+				labelDepth[target] = long(depth);
+				return true;
+			}
+			return labelDepth[target] == long(depth);
+		}
+
+		void addJumpFixup(size_t oldTarget, bool backwards, bool wide = false) {
+			fixups.push_back({ code.size() - (wide ? 4 : 2), code.size(), oldTarget, backwards, wide });
+		}
+
+		bool stackInstruction(const instruction& inst) {
+			long effect;
+			if (!ch->stackEffect(inst.offset, effect))
+				return false;
+			flush();
+			for (size_t i = 0; i < inst.length; i++)
+				emitByte(ch->accessAt(inst.offset + i));
+			if (long(stack.size()) + effect < 0)
+				return false;
+			resetStack(stack.size() + effect);
+			return true;
+		}
+
+		bool isFollowedBy(size_t i, unsigned char op) {
+			return i + 1 < insts.size() && insts[i + 1].op == op && !isTarget[insts[i + 1].offset];
+		}
+
+		static opCodes arithmeticOp(unsigned char op) {
+			switch (op) {
+			case OP_ADD: return OP_REG_ADD;
+			case OP_SUB: return OP_REG_SUB;
+			case OP_MUL: return OP_REG_MUL;
+			case OP_DIV: return OP_REG_DIV;
+			default: return OP_REG_MODULO;
+			}
+		}
+
+		static opCodes compareJumpOp(unsigned char op) {
+			switch (op) {
+			case OP_LESSER: return OP_REG_JUMP_IF_NOT_LESSER;
+			case OP_LESSER_OR_EQUALS: return OP_REG_JUMP_IF_NOT_LESSER_OR_EQUALS;
+			case OP_GREATER: return OP_REG_JUMP_IF_NOT_GREATER;
+			case OP_GREATER_OR_EQUALS: return OP_REG_JUMP_IF_NOT_GREATER_OR_EQUALS;
+			case OP_EQUALS: return OP_REG_JUMP_IF_NOT_EQUALS;
+			default: return OP_REG_JUMP_IF_NOT_NOT_EQUALS;
+			}
+		}
+
+		bool translateInstruction(size_t& i, bool& reachable) {
+			const instruction& inst = insts[i];
+			switch (inst.op) {
+			case OP_CONSTANT: {
+				size_t index = readShortAt(inst.offset + 1);
+				if (index >= REG_CONSTANT_BIT)
+					return stackInstruction(inst);
+				stack.push_back({ OPERAND_CONSTANT, index });
+				return true;
+			}
+			case OP_GET_LOCAL: {
+				size_t local = readShortAt(inst.offset + 1);
+				if (local >= stack.size())
+					return false;
+				store(local, local + 1);
+				stack.push_back({ OPERAND_LOCAL, local });
+				return true;
+			}
+			case OP_SET_LOCAL: {
+				size_t local = readShortAt(inst.offset + 1);
+				if (stack.empty() || local >= stack.size() - 1)
+					return stackInstruction(inst);
+				size_t top = stack.size() - 1;
+				bool canRetarget = lastDestinationPos != NO_POSITION && lastDestinationSlot == top;
+				size_t destinationPos = lastDestinationPos;
+				storeReferencesTo(local, top);
+				if (canRetarget && lastDestinationPos == destinationPos) {
+					// let the arithmetic instruction write into the local directly
+					encodeShort(&code[destinationPos], local);
+					lastDestinationPos = NO_POSITION;
+					stack[top] = { OPERAND_LOCAL, local };
+				}
+				else if (!(stack[top].kind == OPERAND_LOCAL && stack[top].index == local)) {
+					size_t src = operand(top);
+					emitByte(OP_REG_MOVE);
+					emitShort(local);
+					emitShort(src);
+				}
+				stack[local] = { OPERAND_SLOT, local };
+				return true;
+			}
+			case OP_POP: {
+				if (stack.empty())
+					return false;
+				stackEntry entry = stack.back();
+				stack.pop_back();
+				if (entry.kind == OPERAND_SLOT && spDepth == stack.size() + 1) {
+					emitByte(OP_POP);
+					spDepth--;
+				}
+				return true;
+			}
+			case OP_INCREMENT_LOCAL:
+			case OP_DECREMENT_LOCAL: {
+				size_t local = readShortAt(inst.offset + 1);
+				if (local >= stack.size())
+					return false;
+				if (stack.back().kind == OPERAND_LOCAL && stack.back().index == local && isFollowedBy(i, OP_POP)) {
+					// 'i++;' as a statement, the old value is never used
+					stack.pop_back();
+					i++;
+				}
+				store(local, local + 1);
+				storeReferencesTo(local, stack.size());
+				for (size_t b = 0; b < inst.length; b++)
+					emitByte(ch->accessAt(inst.offset + b));
+				return true;
+			}
+			case OP_ADD:
+			case OP_SUB:
+			case OP_MUL:
+			case OP_DIV:
+			case OP_MODULO: {
+				if (stack.size() < 2)
+					return false;
+				size_t destination = stack.size() - 2;
+				if (stack[destination].kind == OPERAND_SLOT && stack[destination + 1].kind == OPERAND_SLOT
+					&& spDepth == stack.size()) {
+					// both operands are already on top of the stack
+					return stackInstruction(inst);
+				}
+				size_t a = operand(destination);
+				size_t b = operand(destination + 1);
+				if (inst.op == OP_ADD && spDepth < destination) {
+					// concatenating strings allocates, so the values below have to be reachable by the GC.
+					// everything below the stack pointer is, the slow path pushes its operands there
+					store(spDepth, destination);
+					syncTop(destination);
+				}
+				emitByte(arithmeticOp(inst.op));
+				emitShort(destination);
+				emitShort(a);
+				emitShort(b);
+				lastDestinationPos = code.size() - 6;
+				lastDestinationSlot = destination;
+				stack.resize(destination);
+				stack.push_back({ OPERAND_SLOT, destination });
+				return true;
+			}
+			case OP_LESSER:
+			case OP_LESSER_OR_EQUALS:
+			case OP_GREATER:
+			case OP_GREATER_OR_EQUALS:
+			case OP_EQUALS:
+			case OP_NOT_EQUALS: {
+				if (stack.size() < 2 || !isFollowedBy(i, OP_JUMP_IF_FALSE_WIDE) || !isFollowedBy(i + 1, OP_POP))
+					return stackInstruction(inst);
+				size_t a = operand(stack.size() - 2);
+				size_t b = operand(stack.size() - 1);
+				stack.resize(stack.size() - 2);
+				flush();
+				emitByte(compareJumpOp(inst.op));
+				emitShort(a);
+				emitShort(b);
+				emitShort(0);
+				// the condition is still on the stack when jumping
+				size_t target = jumpTarget(insts[i + 1]);
+				addJumpFixup(target, false);
+				i += 2;
+				return mergeDepth(target, stack.size() + 1);
+			}
+			case OP_JUMP:
+			case OP_JUMP_WIDE:
+			case OP_JUMP_IF_FALSE:
+			case OP_JUMP_IF_FALSE_WIDE:
+			case OP_LOOP:
+			case OP_LOOP_WIDE: {
+				flush();
+				// the short form, if the old offset fits. if the new code grew too much, the translation fails
+				bool wide = jumpDistance(inst) > UINT16_MAX;
+				unsigned char op = isWideJump(inst.op) ? inst.op - 1 : inst.op;
+				emitByte(wide ? op + 1 : op);
+				for (size_t b = 0; b < (wide ? 4 : 2); b++)
+					emitByte(0);
+				size_t target = jumpTarget(inst);
+				addJumpFixup(target, isLoop(inst.op), wide);
+				if (op != OP_JUMP_IF_FALSE)
+					reachable = false;
+				return mergeDepth(target, stack.size());
+			}
+			case OP_RETURN: {
+				reachable = false;
+				if (stack.empty()) {
+					// end of a script, there is no value to return
+					flush();
+					emitByte(OP_RETURN);
+					return true;
+				}
+				size_t src = operand(stack.size() - 1);
+				emitByte(OP_REG_RETURN);
+				emitShort(src);
+				return true;
+			}
+			default:
+				return stackInstruction(inst);
+			}
+		}
+
+	public:
+		explicit translator(chunk* ch) : ch(ch) {}
+
+		bool translate(size_t arity) {
+			size_t size = ch->getSize();
+			for (size_t offset = 0; offset < size;) {
+				instruction inst{ offset, ch->instructionLength(offset), (unsigned char)ch->accessAt(offset) };
+				if (offset + inst.length > size)
+					return false;
+				insts.push_back(inst);
+				offset += inst.length;
+			}
+
+			std::vector<bool> isStart(size + 1, false);
+			isTarget.assign(size + 1, false);
+			labelDepth.assign(size + 1, -1);
+			newOffset.assign(size + 1, 0);
+			for (auto& inst : insts)
+				isStart[inst.offset] = true;
+			isStart[size] = true;
+			for (auto& inst : insts) {
+				if (!isJump(inst.op))
+					continue;
+				size_t target = jumpTarget(inst);
+				if (target > size || !isStart[target])
+					return false;
+				isTarget[target] = true;
+			}
+
+			resetStack(arity);
+			bool reachable = true;
+			for (size_t i = 0; i < insts.size(); i++) {
+				size_t offset = insts[i].offset;
+				line = ch->getLine(offset);
+				// code after a return or jump that no jump lands in is never executed
+				if (!reachable && !isTarget[offset])
+					continue;
+				if (isTarget[offset]) {
+					if (reachable) {
+						flush();
+						if (!mergeDepth(offset, stack.size()))
+							return false;
+					}
+					else {
+						if (labelDepth[offset] < 0)
+							labelDepth[offset] = long(stack.size());
+						resetStack(labelDepth[offset]);
+					}
+					reachable = true;
+					lastDestinationPos = NO_POSITION;
+				}
+				newOffset[offset] = code.size();
+				if (!translateInstruction(i, reachable))
+					return false;
+			}
+			newOffset[size] = code.size();
+
+			for (auto& fix : fixups) {
+				size_t target = newOffset[fix.oldTarget];
+				size_t offset = fix.backwards ? fix.instEnd - target : target - fix.instEnd;
+				if ((fix.backwards ? target > fix.instEnd : target < fix.instEnd) || offset > (fix.wide ? UINT32_MAX : UINT16_MAX))
+					return false;
+				if (fix.wide)
+					encodeInt(&code[fix.operandPos], offset);
+				else
+					encodeShort(&code[fix.operandPos], offset);
+			}
+
+			if (failed)
+				return false;
+
+			ch->replaceCode(std::move(code), std::move(lines));
+			return true;
+		}
+	};
+}
+
+bool registerCompiler::translateFunction(objFunction* function) {
+	translator translator(function->getChunkPtr());
+	return translator.translate(function->getArity());
+}
@@ -39,7 +39,7 @@ static bool verifyFileName(const char* name) {
     return isValid;
 }
 
-bool runFile(const char* path) {
+bool runFile(const char* path, vmBackend backend) {
 
     //TODO: use 'bool imported' to make automatic search for .shrimp and .🦐 files
     if (!verifyFileName(path)) {
@@ -67,6 +67,7 @@ bool runFile(const char* path) {
 
     VM vm;
     vm.currentPath = pathWithoutFile;
+    vm.backend = backend;
     vm.interpret(cont);
 
     delete[] cont;
@@ -4,17 +4,20 @@
 
 #include "../../header/runFile.hpp"
 
+#include <algorithm>
+
 #ifdef DEBUG_TRACE_EXECUTION
 #include <iomanip>
 #endif
 
 memoryManager globalMemory;
 
-VM::VM() : ip(), activeClosure(nullptr), memory(globalMemory), callFrames() {
+VM::VM() : ip(), activeClosure(nullptr), memory(globalMemory), callFrames(FRAMES_INITIAL_SIZE) {
 	memory.setVM(this);
 	currentCompiler = new compiler(*this, constVector);
 
-	stack = new value[STACK_MAX];
+	stack = new value[STACK_INITIAL_SIZE];
+	stackEnd = stack + STACK_INITIAL_SIZE;
 	activeCallFrameBottom = stack;
 	stackTop = stack;
 
@@ -31,6 +34,10 @@ exitCodes VM::interpret(char* str) {
 	exitCodes exited = INTERPRET_RUNTIME_ERROR;
 
 	if (!currentCompiler->errorOccured()) {
+		if (!reserveStack(activeFunc->stackSlots)) {
+			runtimeError("stack overflow");
+			return INTERPRET_RUNTIME_ERROR;
+		}
 		exited = run();
 	}
 
@@ -52,7 +59,18 @@ void VM::interpretImportFile(const char* name, char* str) {
 	gcReady = true;
 
 	if (!currentCompiler->errorOccured()) {
-		run();
+		// the imported script gets its own frame on top of the importing one,
+		// so its locals and temporaries don't overwrite the importers slots
+		// offsets instead of pointers, the stack may move while the import runs
+		size_t prevFrameBottom = activeCallFrameBottom - stack;
+		size_t prevStackTop = stackTop - stack;
+		activeCallFrameBottom = stackTop;
+		if (reserveStack(activeFunc->stackSlots))
+			run();
+		else
+			runtimeError("stack overflow");
+		activeCallFrameBottom = stack + prevFrameBottom;
+		stackTop = stack + prevStackTop;
 	}
 
 
@@ -66,8 +84,17 @@ void VM::interpretImportFile(const char* name, char* str) {
 }
 
 VM::~VM() {
+#ifdef DEBUG_PROFILE_OPCODES
+	debug::printOpcodeProfile(40);
+#endif
+#ifdef DEBUG_TABLE_STATS
+	memory.printTableStats();
+#endif
+
 	memory.internedStrings.clear();
 	globals.clear();
+	globalNames.clear();
+	globalSlots.clear();
 
 	delete currentCompiler;
 
@@ -75,6 +102,60 @@ VM::~VM() {
 	//std::cout << memory.bytesAllocated;
 }
 
+size_t VM::globalSlot(objString* name) {
+	auto slot = globalSlots.find(name);
+	if (slot != globalSlots.end()) {
+		return slot->second;
+	}
+
+	globalSlots.insert_or_assign(name, globals.size());
+	globalNames.push_back(name);
+	globals.push_back(UNDEFINED_VAL);
+	return globals.size() - 1;
+}
+
+void VM::defineGlobal(objString* name, value val) {
+	globals[globalSlot(name)] = val;
+}
+
+bool VM::growStack(size_t slots) {
+	size_t used = stackTop - stack;
+	if (used + slots > stackLimit)
+		return false;
+
+	size_t capacity = std::min(std::max(size_t(stackEnd - stack) * 2, used + slots), stackLimit);
+	value* newStack = new value[capacity];
+	std::copy(stack, stackTop, newStack);
+
+	// everything pointing into the old stack is moved by the same distance
+	auto relocate = [this, newStack](value* slot) { return newStack + (slot - stack); };
+	for (size_t i = 0; i < callDepth; i++) {
+		callFrames[i].bottom = relocate(callFrames[i].bottom);
+		callFrames[i].top = relocate(callFrames[i].top);
+	}
+	for (objUpvalue* upvalue = openUpvalues; upvalue != nullptr; upvalue = upvalue->next) {
+		upvalue->location = relocate(upvalue->location);
+	}
+	activeCallFrameBottom = relocate(activeCallFrameBottom);
+	stackTop = relocate(stackTop);
+
+	delete[] stack;
+	stack = newStack;
+	stackEnd = newStack + capacity;
+	return true;
+}
+
+void VM::defineBuiltinClass(objType type, objClass* klass) {
+	klass->indexBySymbol();
+	builtinClasses[type] = klass;
+}
+
+void VM::setStackLimits(size_t maxValues, size_t maxFrames) {
+	// never below what is already in use
+	stackLimit = std::max(std::min(maxValues, size_t(STACK_HARD_LIMIT)), size_t(stackEnd - stack));
+	frameLimit = std::max(std::min(maxFrames, size_t(FRAMES_HARD_LIMIT)), callFrames.size());
+}
+
 void VM::push(value val) {
 	*stackTop = val;
 	stackTop++;
@@ -97,17 +178,7 @@ bool VM::concatenateTwoStrings() {
 		return false;
 	}
 
-	char* res = memory.allocateArray<char>(len + 1);
-	memcpy(res, a->getChars(), a->getLen());
-	memcpy(res + a->getLen(), b->getChars(), b->getLen());
-	res[len] = '\0';
-
-	objString* strObj = nullptr;
-	// strObj->mark();
-	// push(OBJ_VAL(strObj));
-	strObj = objString::takeString(res, len);
-	// pop();
-	// strObj->unmark();
+	objString* strObj = objString::concatenate(a, b);
 	pop();
 	pop();
 	push(OBJ_VAL(strObj));
@@ -115,6 +186,94 @@ bool VM::concatenateTwoStrings() {
 	return true;
 }
 
+bool VM::concatenateStrings(size_t count) {
+	value* operands = stackTop - count;
+	unsigned long long len = 0;
+	for (size_t i = 0; i < count; i++) {
+		if (!IS_STR(operands[i])) {
+			// added one after another from the left, like the OP_ADDs the compiler replaced
+			if (!reserveStack(2)) {
+				return runtimeError("stack overflow");
+			}
+			operands = stackTop - count;
+			for (size_t j = 1; j < count; j++) {
+				push(operands[0]);
+				push(operands[j]);
+				if (!add()) {
+					return false;
+				}
+				operands[0] = pop();
+			}
+			stackTop = operands + 1;
+			return true;
+		}
+		len += AS_STR(operands[i])->getLen();
+	}
+
+	if (len > UINT32_MAX) {
+		return runtimeError("string concatenation exceeds maximum size");
+	}
+
+	objString* strObj = objString::concatenate(operands, count, len);
+	stackTop = operands;
+	push(OBJ_VAL(strObj));
+
+	return true;
+}
+
+static inline double moduloNumbers(double a, double b) {
+	//checking if numbers are ints, and use normal modulo
+	long long aInt = a;
+	long long bInt = b;
+
+	if ((a == aInt) && (b == bInt)) {
+		return double(aInt % bInt);
+	}
+
+	//floating modulo operation
+	long long tmp = a / b;
+
+	double stepMul = tmp * b;
+
+	return a - stepMul;
+}
+
+/*
+ * arithmetic on two numbers. if both are small ints, the result stays one unless
+ * it overflows, everything else is computed on doubles
+ */
+static inline value addNumbers(value a, value b) {
+	if (IS_SMALL_INT(a) && IS_SMALL_INT(b))
+		return integerValue((long long)AS_SMALL_INT(a) + AS_SMALL_INT(b));
+	return NUM_VAL(AS_NUM(a) + AS_NUM(b));
+}
+
+static inline value subNumbers(value a, value b) {
+	if (IS_SMALL_INT(a) && IS_SMALL_INT(b))
+		return integerValue((long long)AS_SMALL_INT(a) - AS_SMALL_INT(b));
+	return NUM_VAL(AS_NUM(a) - AS_NUM(b));
+}
+
+static inline value mulNumbers(value a, value b) {
+	if (IS_SMALL_INT(a) && IS_SMALL_INT(b)) {
+		long long res = (long long)AS_SMALL_INT(a) * AS_SMALL_INT(b);
+		// a zero result might have to be -0.0
+		if (res != 0)
+			return integerValue(res);
+	}
+	return NUM_VAL(AS_NUM(a) * AS_NUM(b));
+}
+
+// evaluates to the comparison of two numbers, small ints are compared without converting them
+#define COMPARE_NUMBERS(a, b, op) \
+	((IS_SMALL_INT(a) && IS_SMALL_INT(b)) ? (AS_SMALL_INT(a) op AS_SMALL_INT(b)) : (AS_NUM(a) op AS_NUM(b)))
+
+static inline value moduloValues(value a, value b) {
+	if (IS_SMALL_INT(a) && IS_SMALL_INT(b) && AS_SMALL_INT(b) != 0)
+		return integerValue((long long)AS_SMALL_INT(a) % AS_SMALL_INT(b));
+	return NUM_VAL(moduloNumbers(AS_NUM(a), AS_NUM(b)));
+}
+
 bool VM::add() {
 	value b = peek(0);
 	value a = peek(1);
@@ -136,7 +295,7 @@ bool VM::add() {
 		return runtimeError("can't add '", a, "' and '", b, "'");
 	b = pop();
 	a = pop();
-	push(NUM_VAL(AS_NUM(a) + AS_NUM(b)));
+	push(addNumbers(a, b));
 	return true;
 }
 
@@ -145,7 +304,7 @@ bool VM::sub() {
 	value a = pop();
 	if (!(IS_NUM(a) && IS_NUM(b)))
 		return runtimeError("can't subtract '", b, "' from '", a, "'");
-	push(NUM_VAL(AS_NUM(a) - AS_NUM(b)));
+	push(subNumbers(a, b));
 	return true;
 }
 
@@ -154,7 +313,7 @@ bool VM::mul() {
 	value a = pop();
 	if (!(IS_NUM(a) && IS_NUM(b)))
 		return runtimeError("can't multiply '", a, "' and '", b, "'");
-	push(NUM_VAL(AS_NUM(a) * AS_NUM(b)));
+	push(mulNumbers(a, b));
 	return true;
 }
 
@@ -167,29 +326,14 @@ bool VM::div() {
 	return true;
 }
 
+
 bool VM::modulo() {
 	value b = pop();
 	value a = pop();
 	if (!(IS_NUM(a) && IS_NUM(b)))
 		return runtimeError("can't get modulo of '", a, "' and '", b, "'");
 
-	//checking if numbers are ints, and use normal modulo
-	long long aInt = AS_NUM(a);
-	long long bInt = AS_NUM(b);
-
-	if ((AS_NUM(a) == aInt) && (AS_NUM(b) == bInt)) {
-		push(NUM_VAL(double(aInt % bInt)));
-	}
-	else {
-		//floating modulo operation
-		long long tmp = AS_NUM(a) / AS_NUM(b);
-
-		double stepMul = tmp * AS_NUM(b);
-
-		double res = AS_NUM(a) - stepMul;
-
-		push(NUM_VAL(double(res)));
-	}
+	push(moduloValues(a, b));
 	return true;
 }
 
@@ -233,6 +377,9 @@ bool VM::isFalsey(value a) {
 }
 
 bool VM::areEqual(value b, value a) {
+	if (IS_SMALL_INT(a) && IS_SMALL_INT(b))
+		return AS_SMALL_INT(a) == AS_SMALL_INT(b);
+
 	if (IS_NIL(a) && IS_NIL(b))
 		return true;
 
@@ -242,6 +389,9 @@ bool VM::areEqual(value b, value a) {
 	if (IS_BOOL(a) && IS_BOOL(b))
 		return AS_BOOL(a) == AS_BOOL(b);
 
+	if (IS_STR(a) && IS_STR(b))
+		return objString::equal(AS_STR(a), AS_STR(b));
+
 	if (IS_OBJ(a) && IS_OBJ(b))
 		return AS_OBJ(a) == AS_OBJ(b);
 
@@ -268,18 +418,24 @@ bool VM::areEqual(value b, value a) {
 
 bool VM::call(value callee, int arity) {
 	auto* fun = (objClosure*)AS_OBJ(callee);
+	if (callDepth == callFrames.size()) {
+		if (callDepth >= frameLimit)
+			return runtimeError("stack overflow");
+		callFrames.resize(std::min(callDepth * 2, frameLimit));
+	}
+
 	callFrames[callDepth].bottom = activeCallFrameBottom;
 	callFrames[callDepth].closure = activeClosure;
 	callFrames[callDepth].top = stackTop - arity;
 	callFrames[callDepth].returnPtr = ip;
 	callDepth++;
 
-	if (callDepth >= FRAMES_MAX)
-		return runtimeError("stack overflow");
-
 	if (arity != fun->function->getArity())
 		return runtimeError("expected ", fun->function->getArity(), " arguments, but got ", arity);
 
+	if (!reserveStack(fun->function->stackSlots - arity))
+		return runtimeError("stack overflow");
+
 	/*auto retAdr = reinterpret_cast<uintptr_t>(ip);
 	//fun->retAddress = retAdr;
 	value replacing = peek(arity);
@@ -297,6 +453,17 @@ bool VM::call(value callee, int arity) {
 	return true;
 }
 
+// the result replaces the callee on the stack
+bool VM::callNative(objNativeFunction* native, int arity) {
+	bool success = true;
+	value result = native->fun(arity, stackTop - arity, success);
+	stackTop -= arity + 1;
+	push(result);
+	if (!success)
+		return runtimeError(((objString*)AS_OBJ(result))->getChars());
+	return true;
+}
+
 bool VM::callValue(value callee, int arity) {
 	if (IS_OBJ(callee)) {
 		obj* cal = AS_OBJ(callee);
@@ -307,16 +474,8 @@ bool VM::callValue(value callee, int arity) {
 		if (cal->getType() == OBJ_CLOSURE)
 			return call(callee, arity);
 
-		if (cal->getType() == OBJ_NAT_FUN) {
-			bool success = true;
-			value result = ((objNativeFunction*)cal)->fun(arity, stackTop - arity, success);
-			stackTop -= arity + 1;
-			push(result);
-			if (success) {
-				return true;
-			}
-			return runtimeError(((objString*)AS_OBJ(result))->getChars());
-		}
+		if (cal->getType() == OBJ_NAT_FUN)
+			return callNative((objNativeFunction*)cal, arity);
 
 		if (cal->getType() == OBJ_CLASS) {
 			auto* cl = (objClass*)AS_OBJ(peek(arity));
@@ -374,143 +533,150 @@ bool VM::defineMemberVar() {
 	objClass* cl = (objClass*)AS_OBJ(peek(1));
 
 	cl->tableSet(name, val);
+	cl->addMemberVariable(name, val);
 	pop();
 
 	return true;
 }
 
-bool VM::invoke() {
-	objString* name = (objString*)AS_OBJ(activeClosure->function->getChunkPtr()->getConstant(readShort()));
-	int argc = readByte();
-	value callee = peek(argc);
+// the entry the next miss of the cache overwrites
+static inline inlineCacheEntry& replacedEntry(inlineCache& cache) {
+	inlineCacheEntry& entry = cache.entries[cache.next];
+	cache.next = (cache.next + 1) % INLINE_CACHE_SIZE;
+	return entry;
+}
 
-	if (!IS_OBJ(callee)) {
-		return runtimeError("can only invoke methods on objects");
+static inline void validateCache(inlineCache& cache) {
+	if (cache.generation != objClass::generation) {
+		cache = inlineCache();
+		cache.generation = objClass::generation;
 	}
+}
 
-	switch (AS_OBJ(callee)->getType()) {
-	case OBJ_INSTANCE: {
-		auto* instance = (objInstance*)AS_OBJ(callee);
-
-		value method = instance->tableGet(name);
+// the method name resolves to in klass, the cache of the executing instruction remembers it for the next time
+static inline value cachedMethod(inlineCache& cache, objClass* klass, objString* name) {
+	validateCache(cache);
+	for (auto& entry : cache.entries) {
+		if (entry.klass == klass && entry.layout == nullptr)
+			return entry.method;
+	}
 
-		// instance should already be at position of 'this'
-		// peek_set(argc, OBJ_VAL(instance));
+	inlineCacheEntry& entry = replacedEntry(cache);
+	entry = inlineCacheEntry();
+	entry.klass = klass;
+	entry.method = klass->tableGet(name);
+	return entry.method;
+}
 
-		if (IS_OBJ(method) && AS_OBJ(method)->getType() == OBJ_CLOSURE) {
-			return call(method, argc);
-		}
-		else if (IS_OBJ(method) && AS_OBJ(method)->getType() == OBJ_NAT_FUN) {
-			return callValue(method, argc);
+// fields of the instance shadow the members of its class
+static inline value cachedProperty(inlineCache& cache, objInstance* instance, objString* name) {
+	validateCache(cache);
+	inlineCacheEntry* found = nullptr;
+	for (auto& entry : cache.entries) {
+		if (entry.layout == instance->layout) {
+			found = &entry;
+			break;
 		}
-		return runtimeError("no function with name '", name->getChars(), "' on instance");
-		break;
 	}
-	case OBJ_STR: {
-		value method = stringClass->tableGet(name);
-
-		// instance should already be at position of 'this'
-		// peek_set(argc, OBJ_VAL(instance));
 
-		if (IS_OBJ(method) && AS_OBJ(method)->getType() == OBJ_CLOSURE) {
-			return call(method, argc);
-		}
-		else
-			if (IS_OBJ(method) && AS_OBJ(method)->getType() == OBJ_NAT_FUN) {
-				bool success = true;
-				value result = ((objNativeFunction*)(AS_OBJ(method)))->fun(argc, stackTop - argc, success);
-				stackTop -= argc + 1;
-				push(result);
-				if (!success)
-					return runtimeError(((objString*)AS_OBJ(result))->getChars());
-				return success;
-			}
-			else {
-				return runtimeError("no function with name '", name->getChars(), "' on string class");
-			}
-		break;
+	if (found == nullptr) {
+		found = &replacedEntry(cache);
+		*found = inlineCacheEntry();
+		found->klass = instance->klass;
+		found->layout = instance->layout;
+		found->slot = instance->layout->find(name);
+		if (found->slot < 0)
+			found->method = instance->klass->tableGet(name);
 	}
-	case OBJ_LIST: {
-		value method = arrayClass->tableGet(name);
 
-		// instance should already be at position of 'this'
-		// peek_set(argc, OBJ_VAL(instance));
+	if (found->slot < 0)
+		return found->method;
+	value field = instance->fields[found->slot];
+	// a deleted field, the class is asked instead
+	if (IS_UNDEFINED(field))
+		return instance->klass->tableGet(name);
+	return field;
+}
 
-		if (IS_OBJ(method) && AS_OBJ(method)->getType() == OBJ_CLOSURE) {
-			return call(method, argc);
-		}
-		else
-			if (IS_OBJ(method) && AS_OBJ(method)->getType() == OBJ_NAT_FUN) {
-				bool success = true;
-				value result = ((objNativeFunction*)(AS_OBJ(method)))->fun(argc, stackTop - argc, success);
-				stackTop -= argc + 1;
-				push(result);
-				if (!success)
-					return runtimeError(((objString*)AS_OBJ(result))->getChars());
-				return success;
-			}
-			else {
-				return runtimeError("no function with name '", name->getChars(), "' on array class");
-			}
-		break;;
+// assigning nil deletes the field
+static inline void cachedSetProperty(inlineCache& cache, objInstance* instance, objString* name, value val) {
+	if (IS_NIL(val)) {
+		instance->tableDelete(name);
+		return;
 	}
-	case OBJ_FILE: {
-		value method = fileClass->tableGet(name);
-
-		// instance should already be at position of 'this'
-		// peek_set(argc, OBJ_VAL(instance));
 
-		if (IS_OBJ(method) && AS_OBJ(method)->getType() == OBJ_CLOSURE) {
-			return call(method, argc);
-		}
-		else
-			if (IS_OBJ(method) && AS_OBJ(method)->getType() == OBJ_NAT_FUN) {
-				bool success = true;
-				value result = ((objNativeFunction*)(AS_OBJ(method)))->fun(argc, stackTop - argc, success);
-				stackTop -= argc + 1;
-				push(result);
-				if (!success)
-					return runtimeError(((objString*)AS_OBJ(result))->getChars());
-				return success;
+	for (auto& entry : cache.entries) {
+		if (entry.layout == instance->layout && entry.target != nullptr) {
+			instance->writeBarrier(val);
+			if (entry.target != entry.layout) {
+				instance->fields.push_back(val);
+				instance->layout = entry.target;
 			}
 			else {
-				return runtimeError("no function with name '", name->getChars(), "' on file class");
+				instance->fields[entry.slot] = val;
 			}
-		break;
+			return;
+		}
 	}
-	case OBJ_CLASS: {
-		auto klass = (objClass*)AS_OBJ(callee);
 
-		value method = klass->tableGet(name);
+	inlineCacheEntry& entry = replacedEntry(cache);
+	entry = inlineCacheEntry();
+	entry.klass = instance->klass;
+	entry.layout = instance->layout;
+	instance->tableSet(name, val);
+	entry.slot = instance->layout->find(name);
+	entry.target = instance->layout;
+}
 
-		if (IS_OBJ(method) && AS_OBJ(method)->getType() == OBJ_NAT_FUN) {
-			bool success = true;
-			//popping class
-			value result = ((objNativeFunction*)AS_OBJ(method))->fun(argc, stackTop - argc, success);
-			stackTop -= argc + 1;
-			push(result);
-			if (!success)
-				return runtimeError(((objString*)AS_OBJ(result))->getChars());
-			return success;
-		}
+bool VM::invoke() {
+	chunk* ch = activeClosure->function->getChunkPtr();
+	objString* name = (objString*)AS_OBJ(ch->getConstant(readShort()));
+	int argc = readByte();
+	inlineCache& cache = ch->caches[readShort()];
+	value callee = peek(argc);
 
-		if (IS_OBJ(method) && AS_OBJ(method)->getType() == OBJ_CLOSURE) {
-			return call(method, argc);
-		}
-		return runtimeError("no function with name '", name->getChars(), "' on class");
+	if (!IS_OBJ(callee)) {
+		return runtimeError("can only invoke methods on objects");
+	}
+
+	// instance should already be at position of 'this'
+	value method;
+	const char* receiver;
+	switch (AS_OBJ(callee)->getType()) {
+	case OBJ_INSTANCE:
+		method = cachedProperty(cache, (objInstance*)AS_OBJ(callee), name);
+		receiver = "instance";
 		break;
+	case OBJ_CLASS:
+		method = cachedMethod(cache, (objClass*)AS_OBJ(callee), name);
+		receiver = "class";
+		break;
+	default: {
+		objClass* klass = builtinClasses[AS_OBJ(callee)->getType()];
+		if (klass == nullptr) {
+			return runtimeError("can't invoke methods on '", callee, "'");
+		}
+		method = klass->symbolGet(name);
+		receiver = klass->getName()->getChars();
 		break;
 	}
-	default:
-		return runtimeError("unknown error");
 	}
-	return runtimeError("unknown error");
+
+	if (IS_OBJ(method)) {
+		if (AS_OBJ(method)->getType() == OBJ_CLOSURE)
+			return call(method, argc);
+		if (AS_OBJ(method)->getType() == OBJ_NAT_FUN)
+			return callNative((objNativeFunction*)AS_OBJ(method), argc);
+	}
+	return runtimeError("no function with name '", name->getChars(), "' on ", receiver);
 }
 
 bool VM::superInvoke() {
 	//TODO: profile super invoke (and normal super call)
-	objString* name = (objString*)AS_OBJ(activeClosure->function->getChunkPtr()->getConstant(readShort()));
+	chunk* ch = activeClosure->function->getChunkPtr();
+	objString* name = (objString*)AS_OBJ(ch->getConstant(readShort()));
 	int argc = readByte();
+	inlineCache& cache = ch->caches[readShort()];
 	value callee = peek(argc);
 
 	// auto* instance = (objInstance*)AS_OBJ(callee);
@@ -518,7 +684,7 @@ bool VM::superInvoke() {
 	// value this_val = OBJ_VAL(objThis::createObjThis(instance));
 
 	//TODO: access activeFunc
-	value method = activeClosure->function->getClass()->superTableGet(name);
+	value method = cachedMethod(cache, activeClosure->function->getClass()->superClass, name);
 	//value method = ((objThis*)this_val.as.object)->accessSuperClassVariable(name);
 
 	// instance should be at correct position
@@ -531,18 +697,24 @@ bool VM::superInvoke() {
 	return runtimeError("no function with name '", name->getChars(), "' on superclass");
 }
 
-static inline bool validateIndex(double& index, size_t len) {
-	if (index >= len) {
-		return false;
-	}
-
-	if (index < 0) {
-		index = len + index;
-		if (index >= len) {
+// negative indexes count from the end. small ints are checked without converting to double
+static inline bool validateIndex(value index, size_t len, size_t& position) {
+	if (IS_SMALL_INT(index)) {
+		long long i = AS_SMALL_INT(index);
+		if (i < 0)
+			i += len;
+		if (i < 0 || i >= (long long)len)
 			return false;
-		}
+		position = size_t(i);
+		return true;
 	}
 
+	double i = AS_NUM(index);
+	if (i < 0)
+		i += len;
+	if (!(i >= 0 && i < len))
+		return false;
+	position = size_t(i);
 	return true;
 }
 
@@ -554,11 +726,12 @@ bool VM::getObjectIndex(obj* object, value index) {
 
 		auto* list = (objList*)object;
 		size_t len = list->getSize();
-		if (!validateIndex(AS_NUM(index), len)) {
+		size_t position;
+		if (!validateIndex(index, len, position)) {
 			return runtimeError("invalid index, list has size '", len, "'");
 		}
 		pop();
-		push(list->getValueAt(AS_NUM(index)));
+		push(list->getValueAt(position));
 		return true;
 		break;
 	}
@@ -591,10 +764,11 @@ bool VM::setObjectIndex(obj* object, value index, value val) {
 
 		auto* list = (objList*)object;
 		size_t len = list->getSize();
-		if (!validateIndex(AS_NUM(index), len)) {
+		size_t position;
+		if (!validateIndex(index, len, position)) {
 			return runtimeError("invalid index, list has size '", len, "'");
 		}
-		list->setValueAt(AS_NUM(index), val);
+		list->setValueAt(position, val);
 		return true;
 	}
 	case OBJ_MAP: {
@@ -641,599 +815,1147 @@ objUpvalue* VM::captureUpvalue(value* local)
 void VM::closeUpvalue(value* last) {
 	while (openUpvalues != nullptr && openUpvalues->location >= last) {
 		objUpvalue* upvalue = openUpvalues;
+		upvalue->writeBarrier(*upvalue->location);
 		upvalue->closed = *upvalue->location;
 		upvalue->location = &upvalue->closed;
 		openUpvalues = upvalue->next;
 	}
 }
 
-exitCodes VM::run() {
-	ip = activeClosure->function->getChunkPtr()->getInstructionPointer();
-	char c;
-	for (;;) {
+// helpers for VM::run(), working on the state cached in its locals
+#define READ_BYTE() ((unsigned char)*(pc++))
+#define READ_SHORT() (pc += 2, decodeShort(pc - 2))
+#define READ_INT() (pc += 4, decodeInt(pc - 4))
+#define READ_CONSTANT() (constants[READ_SHORT()])
+#define READ_STRING() ((objString*)AS_OBJ(READ_CONSTANT()))
+#define READ_OPERAND() (regOperand(READ_SHORT(), frameBottom, constants))
+
+#define PUSH(val) (*(sp++) = (val))
+#define POP() (*(--sp))
+#define PEEK(dist) (sp[-1 - (dist)])
+#define PEEK_SET(dist, val) (sp[-1 - (dist)] = (val))
+
+#define STORE_STATE() do { ip = pc; stackTop = sp; } while (false)
+#define LOAD_STATE() do { \
+		pc = ip; \
+		sp = stackTop; \
+		frameBottom = activeCallFrameBottom; \
+		closure = activeClosure; \
+		constants = closure->function->getChunkPtr()->getConstantsPtr(); \
+		caches = closure->function->getChunkPtr()->getCachesPtr(); \
+	} while (false)
+
+// replaces the opcode of the executing instruction, the operands stay the same
+#define REWRITE_INSTRUCTION(op) (pc[-1] = char(op))
+
+#define RUNTIME_ERROR(...) do { STORE_STATE(); runtimeError(__VA_ARGS__); return INTERPRET_RUNTIME_ERROR; } while (false)
+
+// operands of the register instructions are frame slots, or constants if REG_CONSTANT_BIT is set
+static inline value regOperand(uint16_t operand, const value* frame, const value* constants) {
+	if (operand & REG_CONSTANT_BIT)
+		return constants[operand & ~REG_CONSTANT_BIT];
+	return frame[operand];
+}
+
 #ifdef DEBUG_TRACE_EXECUTION
-		std::cout << "\t";
-		for (int i = 0; i < stackTop - stack; ++i) {
-			std::cout << " [" << std::setw(6) << std::left << stack[i] << "] ";
-		}
-		std::cout << std::endl;
-		debug::disassembleInstruction(*ip, activeClosure->function->getChunkPtr(), (ip - activeClosure->function->getChunkPtr()->getInstructionPointer()));
+#define TRACE_INSTRUCTION() do { \
+		std::cout << "\t"; \
+		for (int i = 0; i < sp - stack; ++i) { \
+			std::cout << " [" << std::setw(6) << std::left << stack[i] << "] "; \
+		} \
+		std::cout << std::endl; \
+		debug::disassembleInstruction(*pc, closure->function->getChunkPtr(), (pc - closure->function->getChunkPtr()->getInstructionPointer())); \
+	} while (false)
+#else
+#define TRACE_INSTRUCTION() do {} while (false)
 #endif
-		switch (c = readByte()) {
-		case OP_CONSTANT: {
-			short ind = readShort();
-			push(activeClosure->function->getChunkPtr()->getConstant(ind));
-			break;
-		}
-		case OP_ADD:
+
+#ifdef DEBUG_PROFILE_OPCODES
+#define PROFILE_INSTRUCTION() debug::profileInstruction((unsigned char)*pc)
+#else
+#define PROFILE_INSTRUCTION() do {} while (false)
+#endif
+
+/*
+ * with THREADED_DISPATCH every handler jumps directly to the handler of the next
+ * instruction through the label table in VM::run(), so each opcode gets its own
+ * indirect branch the cpu can predict, instead of all sharing the one of the switch
+ */
+#ifdef THREADED_DISPATCH
+#define VM_DISPATCH(op) goto *dispatchTable[(unsigned char)(op)];
+#define VM_CASE(op) LABEL_##op
+#define VM_BREAK do { TRACE_INSTRUCTION(); PROFILE_INSTRUCTION(); VM_DISPATCH(READ_BYTE()) } while (false)
+
+// gcc otherwise merges the dispatch jumps at the end of all handlers back into a single one
+#if defined(__GNUC__) && !defined(__clang__)
+#define RUN_ATTRIBUTES __attribute__((optimize("no-gcse", "no-crossjumping")))
+#endif
+#else
+#define VM_DISPATCH(op) switch (op)
+#define VM_CASE(op) case op
+#define VM_BREAK break
+#endif
+
+#ifndef RUN_ATTRIBUTES
+#define RUN_ATTRIBUTES
+#endif
+
+RUN_ATTRIBUTES exitCodes VM::run() {
+#ifdef THREADED_DISPATCH
+	// must have the same order as the opCodes enum in chunk.hpp
+	static void* dispatchTable[] = {
+		&&LABEL_OP_CONSTANT,
+		&&LABEL_OP_CONSTANT_WIDE,
+
+		&&LABEL_OP_ADD,
+		&&LABEL_OP_SUB,
+		&&LABEL_OP_MUL,
+		&&LABEL_OP_DIV,
+		&&LABEL_OP_MODULO,
+		&&LABEL_OP_CONCAT_N,
+
+		&&LABEL_OP_NEGATE,
+		&&LABEL_OP_NOT,
+
+		&&LABEL_OP_INCREMENT_GLOBAL,
+		&&LABEL_OP_DECREMENT_GLOBAL,
+
+		&&LABEL_OP_INCREMENT_LOCAL,
+		&&LABEL_OP_DECREMENT_LOCAL,
+
+		&&LABEL_OP_EQUALS,
+		&&LABEL_OP_CASE_COMPARE,
+		&&LABEL_OP_NOT_EQUALS,
+		&&LABEL_OP_LESSER,
+		&&LABEL_OP_LESSER_OR_EQUALS,
+		&&LABEL_OP_GREATER,
+		&&LABEL_OP_GREATER_OR_EQUALS,
+
+		&&LABEL_OP_BIT_AND,
+		&&LABEL_OP_BIT_OR,
+		&&LABEL_OP_BIT_SHIFT_LEFT,
+		&&LABEL_OP_BIT_SHIFT_RIGHT,
+		&&LABEL_OP_BIT_NOT,
+		&&LABEL_OP_BIT_XOR,
+
+		&&LABEL_OP_TRUE,
+		&&LABEL_OP_FALSE,
+		&&LABEL_OP_NIL,
+
+		&&LABEL_OP_DEFINE_GLOBAL,
+
+		&&LABEL_OP_POP,
+
+		&&LABEL_OP_GET_GLOBAL,
+		&&LABEL_OP_SET_GLOBAL,
+
+		&&LABEL_OP_GET_LOCAL,
+		&&LABEL_OP_SET_LOCAL,
+
+		&&LABEL_OP_GET_UPVALUE,
+		&&LABEL_OP_SET_UPVALUE,
+		&&LABEL_OP_CLOSE_UPVALUE,
+
+		&&LABEL_OP_JUMP,
+		&&LABEL_OP_JUMP_WIDE,
+		&&LABEL_OP_JUMP_IF_FALSE,
+		&&LABEL_OP_JUMP_IF_FALSE_WIDE,
+
+		&&LABEL_OP_LOOP,
+		&&LABEL_OP_LOOP_WIDE,
+
+		&&LABEL_OP_CLOSURE,
+		&&LABEL_OP_CALL,
+		&&LABEL_OP_TAIL_CALL,
+
+		&&LABEL_OP_SET_PROPERTY,
+		&&LABEL_OP_GET_PROPERTY,
+
+		&&LABEL_OP_CLASS,
+		&&LABEL_OP_INHERIT,
+		&&LABEL_OP_MEMBER_VARIABLE,
+		&&LABEL_OP_METHOD,
+		&&LABEL_OP_INVOKE,
+
+		&&LABEL_OP_LIST,
+		&&LABEL_OP_APPEND,
+		&&LABEL_OP_GET_INDEX,
+		&&LABEL_OP_SET_INDEX,
+
+		&&LABEL_OP_MAP,
+		&&LABEL_OP_MAP_APPEND,
+
+		&&LABEL_OP_THIS,
+		&&LABEL_OP_SUPER,
+		&&LABEL_OP_SUPER_INVOKE,
+
+		&&LABEL_OP_ADD_LOCAL_LOCAL,
+		&&LABEL_OP_LESS_LOCAL_CONST_JUMP,
+		&&LABEL_OP_LESS_LOCAL_LOCAL_JUMP,
+		&&LABEL_OP_LESS_EQUAL_LOCAL_LOCAL_JUMP,
+		&&LABEL_OP_GET_PROPERTY_THIS,
+		&&LABEL_OP_SET_LOCAL_POP,
+
+		&&LABEL_OP_ADD_NUM,
+		&&LABEL_OP_ADD_STR,
+
+		&&LABEL_OP_REG_MOVE,
+		&&LABEL_OP_REG_SET_TOP,
+		&&LABEL_OP_REG_ADD,
+		&&LABEL_OP_REG_SUB,
+		&&LABEL_OP_REG_MUL,
+		&&LABEL_OP_REG_DIV,
+		&&LABEL_OP_REG_MODULO,
+		&&LABEL_OP_REG_JUMP_IF_NOT_LESSER,
+		&&LABEL_OP_REG_JUMP_IF_NOT_LESSER_OR_EQUALS,
+		&&LABEL_OP_REG_JUMP_IF_NOT_GREATER,
+		&&LABEL_OP_REG_JUMP_IF_NOT_GREATER_OR_EQUALS,
+		&&LABEL_OP_REG_JUMP_IF_NOT_EQUALS,
+		&&LABEL_OP_REG_JUMP_IF_NOT_NOT_EQUALS,
+		&&LABEL_OP_REG_RETURN,
+
+		&&LABEL_OP_IMPORT,
+		&&LABEL_OP_RETURN,
+	};
+	static_assert(sizeof(dispatchTable) / sizeof(dispatchTable[0]) == OP_RETURN + 1,
+		"dispatchTable must have an entry for every opcode");
+#endif
+
+	/*
+	 * the hot interpreter state is kept in locals, so the compiler can hold it in
+	 * registers instead of going through 'this' on every push, pop and operand read.
+	 * it is written back to the members (STORE_STATE) before anything that reads it
+	 * from there: calls, allocations (the GC marks up to stackTop) and errors
+	 */
+	char* pc;
+	value* sp;
+	value* frameBottom;
+	objClosure* closure;
+	const value* constants;
+	inlineCache* caches;
+
+	ip = activeClosure->function->getChunkPtr()->getInstructionPointer();
+	LOAD_STATE();
+	for (;;) {
+		TRACE_INSTRUCTION();
+		PROFILE_INSTRUCTION();
+		VM_DISPATCH(READ_BYTE()) {
+		VM_CASE(OP_CONSTANT): {
+			PUSH(READ_CONSTANT());
+			VM_BREAK;
+		}
+		VM_CASE(OP_CONSTANT_WIDE): {
+			PUSH(constants[READ_INT()]);
+			VM_BREAK;
+		}
+		VM_CASE(OP_ADD): {
+			value b = PEEK(0);
+			value a = PEEK(1);
+			if (IS_NUM(a) && IS_NUM(b)) {
+				REWRITE_INSTRUCTION(OP_ADD_NUM);
+				sp--;
+				PEEK_SET(0, addNumbers(a, b));
+				VM_BREAK;
+			}
+			if (IS_STR(a) && IS_STR(b)) {
+				REWRITE_INSTRUCTION(OP_ADD_STR);
+			}
+			STORE_STATE();
 			if (!add()) {
 				return INTERPRET_RUNTIME_ERROR;
 			}
-			break;
-		case OP_SUB:
-			if (!sub())
-				return INTERPRET_RUNTIME_ERROR;
-			break;
-		case OP_MUL:
-			if (!mul())
-				return INTERPRET_RUNTIME_ERROR;
-			break;
-		case OP_DIV:
-			if (!div())
+			sp = stackTop;
+			VM_BREAK;
+		}
+		VM_CASE(OP_CONCAT_N): {
+			size_t count = READ_BYTE();
+			STORE_STATE();
+			if (!concatenateStrings(count)) {
 				return INTERPRET_RUNTIME_ERROR;
-			break;
-		case OP_MODULO: {
+			}
+			sp = stackTop;
+			VM_BREAK;
+		}
+		VM_CASE(OP_SUB): {
+			value b = POP();
+			value a = POP();
+			if (!(IS_NUM(a) && IS_NUM(b)))
+				RUNTIME_ERROR("can't subtract '", b, "' from '", a, "'");
+			PUSH(subNumbers(a, b));
+			VM_BREAK;
+		}
+		VM_CASE(OP_MUL): {
+			value b = POP();
+			value a = POP();
+			if (!(IS_NUM(a) && IS_NUM(b)))
+				RUNTIME_ERROR("can't multiply '", a, "' and '", b, "'");
+			PUSH(mulNumbers(a, b));
+			VM_BREAK;
+		}
+		VM_CASE(OP_DIV): {
+			value b = POP();
+			value a = POP();
+			if (!(IS_NUM(a) && IS_NUM(b)))
+				RUNTIME_ERROR("can't divide '", a, "' by '", b, "'");
+			PUSH(NUM_VAL(AS_NUM(a) / AS_NUM(b)));
+			VM_BREAK;
+		}
+		VM_CASE(OP_MODULO): {
+			value b = PEEK(0);
+			value a = PEEK(1);
+			if (IS_SMALL_INT(a) && IS_SMALL_INT(b)) {
+				sp--;
+				PEEK_SET(0, moduloValues(a, b));
+				VM_BREAK;
+			}
+			STORE_STATE();
 			if (!modulo()) {
 				return INTERPRET_RUNTIME_ERROR;
 			}
-			break;
+			sp = stackTop;
+			VM_BREAK;
 		}
-		case OP_NEGATE: {
-			if (!IS_NUM((*(stackTop - 1)))) {
-				runtimeError("can't negate ", *(stackTop - 1));
-				return INTERPRET_RUNTIME_ERROR;
+		VM_CASE(OP_NEGATE): {
+			if (!IS_NUM(PEEK(0))) {
+				RUNTIME_ERROR("can't negate ", PEEK(0));
 			}
-			AS_NUM((*(stackTop - 1))) *= -1;
-			break;
+			value a = PEEK(0);
+			// there is no small int for -0
+			if (IS_SMALL_INT(a) && AS_SMALL_INT(a) != 0)
+				PEEK_SET(0, integerValue(-(long long)AS_SMALL_INT(a)));
+			else
+				PEEK_SET(0, NUM_VAL(-AS_NUM(a)));
+			VM_BREAK;
 		}
-		case OP_NOT:
-			if (isFalsey(pop()))
-				push(FALSE_VAL);
+		VM_CASE(OP_NOT):
+			if (isFalsey(POP()))
+				PUSH(FALSE_VAL);
 			else
-				push(TRUE_VAL);
-			break;
-		case OP_INCREMENT_GLOBAL: {
-			objString* name = (objString*)AS_OBJ(activeClosure->function->getChunkPtr()->getConstant(readShort()));
-
-			if (!globals.count(name)) {
-				runtimeError("no variable with name '", name->getChars(), "'");
-				return INTERPRET_RUNTIME_ERROR;
+				PUSH(TRUE_VAL);
+			VM_BREAK;
+		VM_CASE(OP_INCREMENT_GLOBAL): {
+			uint16_t slot = READ_SHORT();
+
+			value& var = globals[slot];
+			if (IS_UNDEFINED(var)) {
+				RUNTIME_ERROR("no variable with name '", globalNames[slot]->getChars(), "'");
 			}
 
-			value var = globals.at(name);
-
 			if (!IS_NUM(var)) {
-				runtimeError("can only increment numbers");
-				return INTERPRET_RUNTIME_ERROR;
+				RUNTIME_ERROR("can only increment numbers");
 			}
 
-			AS_NUM(var)++;
-			globals.insert_or_assign(name, var);
-			break;
+			var = addNumbers(var, SMALL_INT_VAL(1));
+			VM_BREAK;
 		}
-		case OP_DECREMENT_GLOBAL: {
-			objString* name = (objString*)AS_OBJ(activeClosure->function->getChunkPtr()->getConstant(readShort()));
+		VM_CASE(OP_DECREMENT_GLOBAL): {
+			uint16_t slot = READ_SHORT();
 
-			if (!globals.count(name)) {
-				runtimeError("no variable with name '", name->getChars(), "'");
-				return INTERPRET_RUNTIME_ERROR;
+			value& var = globals[slot];
+			if (IS_UNDEFINED(var)) {
+				RUNTIME_ERROR("no variable with name '", globalNames[slot]->getChars(), "'");
 			}
 
-			value var = globals.at(name);
-
 			if (!IS_NUM(var)) {
-				runtimeError("can only increment numbers");
-				return INTERPRET_RUNTIME_ERROR;
+				RUNTIME_ERROR("can only increment numbers");
 			}
 
-			AS_NUM(var)--;
-			globals.insert_or_assign(name, var);
-			break;
+			var = subNumbers(var, SMALL_INT_VAL(1));
+			VM_BREAK;
 		}
-		case OP_INCREMENT_LOCAL: {
-			int index = readShort();
-			if (!IS_NUM(activeCallFrameBottom[index])) {
-				runtimeError("can only increment numbers");
-				return INTERPRET_RUNTIME_ERROR;
+		VM_CASE(OP_INCREMENT_LOCAL): {
+			int index = READ_SHORT();
+			if (!IS_NUM(frameBottom[index])) {
+				RUNTIME_ERROR("can only increment numbers");
 			}
-			AS_NUM(activeCallFrameBottom[index])++;
-			break;
+			frameBottom[index] = addNumbers(frameBottom[index], SMALL_INT_VAL(1));
+			VM_BREAK;
 		}
-		case OP_DECREMENT_LOCAL: {
-			int index = readShort();
-			if (!IS_NUM(activeCallFrameBottom[index])) {
-				runtimeError("can only increment numbers");
-				return INTERPRET_RUNTIME_ERROR;
+		VM_CASE(OP_DECREMENT_LOCAL): {
+			int index = READ_SHORT();
+			if (!IS_NUM(frameBottom[index])) {
+				RUNTIME_ERROR("can only increment numbers");
 			}
-			AS_NUM(activeCallFrameBottom[index])--;
-			break;
+			frameBottom[index] = subNumbers(frameBottom[index], SMALL_INT_VAL(1));
+			VM_BREAK;
 		}
-		
-		case OP_EQUALS:
-			if (areEqual(pop(), pop()))
-				push(TRUE_VAL);
-			else
-				push(FALSE_VAL);
-			break;
-		case OP_CASE_COMPARE: {
-			value caseVal = pop();
-			if (areEqual(caseVal, peek(0)))
-				push(TRUE_VAL);
+
+		VM_CASE(OP_EQUALS): {
+			value b = POP();
+			value a = POP();
+			if (areEqual(b, a))
+				PUSH(TRUE_VAL);
 			else
-				push(FALSE_VAL);
-			break;
+				PUSH(FALSE_VAL);
+			VM_BREAK;
 		}
-		case OP_NOT_EQUALS:
-			if (areEqual(pop(), pop()))
-				push(FALSE_VAL);
+		VM_CASE(OP_CASE_COMPARE): {
+			value caseVal = POP();
+			if (areEqual(caseVal, PEEK(0)))
+				PUSH(TRUE_VAL);
 			else
-				push(TRUE_VAL);
-			break;
-		case OP_LESSER: {
-			if (IS_NUM(peek(0)) && IS_NUM(peek(1))) {
-				double b = AS_NUM(pop());
-				double a = AS_NUM(pop());
-				if (a < b)
-					push(TRUE_VAL);
+				PUSH(FALSE_VAL);
+			VM_BREAK;
+		}
+		VM_CASE(OP_NOT_EQUALS): {
+			value b = POP();
+			value a = POP();
+			if (areEqual(b, a))
+				PUSH(FALSE_VAL);
+			else
+				PUSH(TRUE_VAL);
+			VM_BREAK;
+		}
+		VM_CASE(OP_LESSER): {
+			if (IS_NUM(PEEK(0)) && IS_NUM(PEEK(1))) {
+				value b = POP();
+				value a = POP();
+				if (COMPARE_NUMBERS(a, b, <))
+					PUSH(TRUE_VAL);
 				else
-					push(FALSE_VAL);
+					PUSH(FALSE_VAL);
 			}
 			else {
-				runtimeError("can only use '<' on numbers");
-				return INTERPRET_RUNTIME_ERROR;
+				RUNTIME_ERROR("can only use '<' on numbers");
 			}
-			break;
-		}
-		case OP_LESSER_OR_EQUALS: {
-			if (IS_NUM(peek(0)) && IS_NUM(peek(1))) {
-				double b = AS_NUM(pop());
-				double a = AS_NUM(pop());
-				if (a <= b)
-					push(TRUE_VAL);
+			VM_BREAK;
+		}
+		VM_CASE(OP_LESSER_OR_EQUALS): {
+			if (IS_NUM(PEEK(0)) && IS_NUM(PEEK(1))) {
+				value b = POP();
+				value a = POP();
+				if (COMPARE_NUMBERS(a, b, <=))
+					PUSH(TRUE_VAL);
 				else
-					push(FALSE_VAL);
+					PUSH(FALSE_VAL);
 			}
 			else {
-				runtimeError("can only use '<=' on numbers");
-				return INTERPRET_RUNTIME_ERROR;
+				RUNTIME_ERROR("can only use '<=' on numbers");
 			}
-			break;
-		}
-		case OP_GREATER: {
-			if (IS_NUM(peek(0)) && IS_NUM(peek(1))) {
-				double b = AS_NUM(pop());
-				double a = AS_NUM(pop());
-				if (a > b)
-					push(TRUE_VAL);
+			VM_BREAK;
+		}
+		VM_CASE(OP_GREATER): {
+			if (IS_NUM(PEEK(0)) && IS_NUM(PEEK(1))) {
+				value b = POP();
+				value a = POP();
+				if (COMPARE_NUMBERS(a, b, >))
+					PUSH(TRUE_VAL);
 				else
-					push(FALSE_VAL);
+					PUSH(FALSE_VAL);
 			}
 			else {
-				runtimeError("can only use '>' on numbers");
-				return INTERPRET_RUNTIME_ERROR;
+				RUNTIME_ERROR("can only use '>' on numbers");
 			}
-			break;
-		}
-		case OP_GREATER_OR_EQUALS: {
-			if (IS_NUM(peek(0)) && IS_NUM(peek(1))) {
-				double b = AS_NUM(pop());
-				double a = AS_NUM(pop());
-				if (a >= b)
-					push(TRUE_VAL);
+			VM_BREAK;
+		}
+		VM_CASE(OP_GREATER_OR_EQUALS): {
+			if (IS_NUM(PEEK(0)) && IS_NUM(PEEK(1))) {
+				value b = POP();
+				value a = POP();
+				if (COMPARE_NUMBERS(a, b, >=))
+					PUSH(TRUE_VAL);
 				else
-					push(FALSE_VAL);
+					PUSH(FALSE_VAL);
 			}
 			else {
-				runtimeError("can only use '>=' on numbers");
-				return INTERPRET_RUNTIME_ERROR;
+				RUNTIME_ERROR("can only use '>=' on numbers");
 			}
-			break;
+			VM_BREAK;
 		}
 								 // bitwise operations
-		case OP_BIT_AND: {
-			value b = pop();
-			value a = pop();
+		VM_CASE(OP_BIT_AND): {
+			value b = POP();
+			value a = POP();
 			if (!IS_INT(a) || !IS_INT(b)) {
-				runtimeError("bitwise operations can only be done on whole numbers");
-				return INTERPRET_RUNTIME_ERROR;
+				RUNTIME_ERROR("bitwise operations can only be done on whole numbers");
 			}
 			long long result = AS_INT(a) & AS_INT(b);
-			push(NUM_VAL(double(result)));
-			break;
+			PUSH(integerValue(result));
+			VM_BREAK;
 		}
-		case OP_BIT_OR: {
-			value b = pop();
-			value a = pop();
+		VM_CASE(OP_BIT_OR): {
+			value b = POP();
+			value a = POP();
 			if (!IS_INT(a) || !IS_INT(b)) {
-				runtimeError("bitwise operations can only be done on whole numbers");
-				return INTERPRET_RUNTIME_ERROR;
+				RUNTIME_ERROR("bitwise operations can only be done on whole numbers");
 			}
 			long long result = AS_INT(a) | AS_INT(b);
-			push(NUM_VAL(double(result)));
-			break;
+			PUSH(integerValue(result));
+			VM_BREAK;
 		}
-		case OP_BIT_SHIFT_LEFT: {
-			value b = pop();
-			value a = pop();
+		VM_CASE(OP_BIT_SHIFT_LEFT): {
+			value b = POP();
+			value a = POP();
 			if (!IS_INT(a) || !IS_INT(b)) {
-				runtimeError("bitwise operations can only be done on whole numbers");
-				return INTERPRET_RUNTIME_ERROR;
+				RUNTIME_ERROR("bitwise operations can only be done on whole numbers");
 			}
 			long long result = AS_INT(a) << AS_INT(b);
-			push(NUM_VAL(double(result)));
-			break;
+			PUSH(integerValue(result));
+			VM_BREAK;
 		}
-		case OP_BIT_SHIFT_RIGHT: {
-			value b = pop();
-			value a = pop();
+		VM_CASE(OP_BIT_SHIFT_RIGHT): {
+			value b = POP();
+			value a = POP();
 			if (!IS_INT(a) || !IS_INT(b)) {
-				runtimeError("bitwise operations can only be done on whole numbers");
-				return INTERPRET_RUNTIME_ERROR;
+				RUNTIME_ERROR("bitwise operations can only be done on whole numbers");
 			}
 			long long result = AS_INT(a) >> AS_INT(b);
-			push(NUM_VAL(double(result)));
-			break;
+			PUSH(integerValue(result));
+			VM_BREAK;
 		}
-		case OP_BIT_NOT: {
-			value a = pop();
+		VM_CASE(OP_BIT_NOT): {
+			value a = POP();
 			if (!IS_INT(a)) {
-				runtimeError("bitwise operations can only be done on whole numbers");
-				return INTERPRET_RUNTIME_ERROR;
+				RUNTIME_ERROR("bitwise operations can only be done on whole numbers");
 			}
 			long long result = ~AS_INT(a);
-			push(NUM_VAL(double(result)));
-			break;
+			PUSH(integerValue(result));
+			VM_BREAK;
 		}
-		case OP_BIT_XOR: {
-			value b = pop();
-			value a = pop();
+		VM_CASE(OP_BIT_XOR): {
+			value b = POP();
+			value a = POP();
 			if (!IS_INT(a) || !IS_INT(b)) {
-				runtimeError("bitwise operations can only be done on whole numbers");
-				return INTERPRET_RUNTIME_ERROR;
+				RUNTIME_ERROR("bitwise operations can only be done on whole numbers");
 			}
 			long long result = AS_INT(a) ^ AS_INT(b);
-			push(NUM_VAL(double(result)));
-			break;
-		}
-		case OP_TRUE:
-			push(TRUE_VAL);
-			break;
-		case OP_FALSE:
-			push(FALSE_VAL);
-			break;
-		case OP_NIL:
-			push(NIL_VAL);
-			break;
+			PUSH(integerValue(result));
+			VM_BREAK;
+		}
+		VM_CASE(OP_TRUE):
+			PUSH(TRUE_VAL);
+			VM_BREAK;
+		VM_CASE(OP_FALSE):
+			PUSH(FALSE_VAL);
+			VM_BREAK;
+		VM_CASE(OP_NIL):
+			PUSH(NIL_VAL);
+			VM_BREAK;
+
+		VM_CASE(OP_DEFINE_GLOBAL): {
+			globals[READ_SHORT()] = PEEK(0);
+			sp--;
+			VM_BREAK;
+		}
+		VM_CASE(OP_POP): {
+			sp--;
+			VM_BREAK;
+		}
+		VM_CASE(OP_GET_GLOBAL): {
+			uint16_t slot = READ_SHORT();
+
+			value global = globals[slot];
+			if (IS_UNDEFINED(global)) {
+				RUNTIME_ERROR("no variable with name '", globalNames[slot]->getChars(), "'");
+			}
 
-		case OP_DEFINE_GLOBAL: {
-			objString* name = (objString*)AS_OBJ(activeClosure->function->getChunkPtr()->getConstant(readShort()));
-			globals.insert_or_assign(name, peek(0));
-			pop();
-			break;
-		}
-		case OP_POP: {
-			pop();
-			break;
+			PUSH(global);
+			VM_BREAK;
 		}
-		case OP_GET_GLOBAL: {
-			chunk* cPtr = activeClosure->function->getChunkPtr();
-			short index = readShort();
-			objString* name = (objString*)AS_OBJ(activeClosure->function->getChunkPtr()->getConstant(index));
+		VM_CASE(OP_SET_GLOBAL): {
+			uint16_t slot = READ_SHORT();
 
-			if (!globals.count(name)) {
-				runtimeError("no variable with name '", name->getChars(), "'");
-				return INTERPRET_RUNTIME_ERROR;
+			if (IS_UNDEFINED(globals[slot])) {
+				RUNTIME_ERROR("no global variable with name '", globalNames[slot]->getChars(), "'");
 			}
-
-			push(globals.at(name));
-			break;
-		}
-		case OP_SET_GLOBAL: {
-			objString* name = (objString*)AS_OBJ(activeClosure->function->getChunkPtr()->getConstant(readShort()));
-			if (!globals.count(name)) {
-				runtimeError("no global variable with name '", name->getChars(), "'");
-				return INTERPRET_RUNTIME_ERROR;
+			globals[slot] = PEEK(0);
+			VM_BREAK;
+		}
+		VM_CASE(OP_GET_LOCAL): {
+			PUSH(frameBottom[READ_SHORT()]);
+			VM_BREAK;
+		}
+		VM_CASE(OP_SET_LOCAL): {
+			frameBottom[READ_SHORT()] = PEEK(0);
+			VM_BREAK;
+		}
+		VM_CASE(OP_GET_UPVALUE): {
+			int index = READ_SHORT();
+			value* upval = closure->upvalues.at(index)->location;
+			PUSH(*upval);
+			VM_BREAK;
+		}
+		VM_CASE(OP_SET_UPVALUE): {
+			int index = READ_SHORT();
+			objUpvalue* upvalue = closure->upvalues.at(index);
+			upvalue->writeBarrier(PEEK(0));
+			*upvalue->location = PEEK(0);
+			VM_BREAK;
+		}
+		VM_CASE(OP_CLOSE_UPVALUE): {
+			closeUpvalue(sp - 1);
+			sp--;
+			VM_BREAK;
+		}
+		VM_CASE(OP_JUMP): {
+			int offset = READ_SHORT();
+			pc += offset;
+			VM_BREAK;
+		}
+		VM_CASE(OP_JUMP_WIDE): {
+			size_t offset = READ_INT();
+			pc += offset;
+			VM_BREAK;
+		}
+		VM_CASE(OP_JUMP_IF_FALSE): {
+			int offset = READ_SHORT();
+			if (!isFalsey(PEEK(0))) {
+				pc += offset;
 			}
-			globals.insert_or_assign(name, peek(0));
-			break;
+			VM_BREAK;
 		}
-		case OP_GET_LOCAL: {
-			push(activeCallFrameBottom[readShort()]);
-			break;
-		}
-		case OP_SET_LOCAL: {
-			activeCallFrameBottom[readShort()] = peek(0);
-			break;
-		}
-		case OP_GET_UPVALUE: {
-			int index = readShort();
-			value* upval = activeClosure->upvalues.at(index)->location;
-			push(*upval);
-			break;
-		}
-		case OP_SET_UPVALUE: {
-			int index = readShort();
-			*activeClosure->upvalues.at(index)->location = peek(0);
-			break;
-		}
-		case OP_CLOSE_UPVALUE: {
-			closeUpvalue(stackTop - 1);
-			pop();
-			break;
-		}
-		case OP_JUMP: {
-			int offset = readShort();
-			ip += offset;
-			break;
-		}
-		case OP_JUMP_IF_FALSE: {
-			int offset = readShort();
-			if (!isFalsey(peek(0))) {
-				ip += offset;
+		VM_CASE(OP_JUMP_IF_FALSE_WIDE): {
+			size_t offset = READ_INT();
+			if (!isFalsey(PEEK(0))) {
+				pc += offset;
 			}
-			break;
+			VM_BREAK;
 		}
-		case OP_LOOP: {
-			int offset = readShort();
-			ip -= offset;
-			break;
+		VM_CASE(OP_LOOP): {
+			int offset = READ_SHORT();
+			pc -= offset;
+			VM_BREAK;
+		}
+		VM_CASE(OP_LOOP_WIDE): {
+			size_t offset = READ_INT();
+			pc -= offset;
+			VM_BREAK;
 		}
-		case OP_CLOSURE: {
-			short ind = readShort();
-			auto function = (objFunction*)AS_OBJ(activeClosure->function->getChunkPtr()->getConstant(ind));
+		VM_CASE(OP_CLOSURE): {
+			auto function = (objFunction*)AS_OBJ(READ_CONSTANT());
 			// function->mark();
-			auto closure = objClosure::createClosure(function);
-			push(OBJ_VAL(closure));
-			closure->upvalues.resize(function->upvalueCount);
+			STORE_STATE();
+			auto newClosure = objClosure::createClosure(function);
+			PUSH(OBJ_VAL(newClosure));
+			// the closure is on the stack now, so the GC finds it while capturing
+			STORE_STATE();
+			newClosure->upvalues.resize(function->upvalueCount);
 			for (int i = 0; i < function->upvalueCount; i++) {
-				uint8_t isLocal = readByte();
-				uint8_t index = readByte();
-				if (isLocal) {
-					closure->upvalues.at(i) = captureUpvalue(activeCallFrameBottom + index);
-				}
-				else {
-					closure->upvalues.at(i) = activeClosure->upvalues.at(i);
-				}
+				uint8_t isLocal = READ_BYTE();
+				uint8_t index = READ_BYTE();
+				// capturing allocates, so the closure may be old by now
+				objUpvalue* upvalue = isLocal ? captureUpvalue(frameBottom + index) : closure->upvalues.at(i);
+				newClosure->writeBarrier(upvalue);
+				newClosure->upvalues.at(i) = upvalue;
 			}
-			
-			break;
+
+			VM_BREAK;
 		}
-		case OP_CALL: {
-			int arity = (unsigned char)readByte();
-			if (!callValue(peek(arity), arity)) {
+		VM_CASE(OP_CALL): {
+			int arity = READ_BYTE();
+			STORE_STATE();
+			if (!callValue(PEEK(arity), arity)) {
 				return INTERPRET_RUNTIME_ERROR;
 			}
-			break;
-		}
-		case OP_SET_PROPERTY: {
-			short ind = readShort();
-			if (IS_OBJ(peek(1))) {
-				switch (AS_OBJ(peek(1))->getType()) {
+			LOAD_STATE();
+			VM_BREAK;
+		}
+		VM_CASE(OP_TAIL_CALL): {
+			int arity = READ_BYTE();
+			value callee = PEEK(arity);
+			// natives and classes are called like with OP_CALL, the OP_RETURN after this returns their result
+			if (callDepth == 0 || !IS_CLOSURE(callee)) {
+				STORE_STATE();
+				if (!callValue(callee, arity)) {
+					return INTERPRET_RUNTIME_ERROR;
+				}
+				LOAD_STATE();
+				VM_BREAK;
+			}
+
+			auto* fun = (objClosure*)AS_OBJ(callee);
+			if (arity != fun->function->getArity()) {
+				RUNTIME_ERROR("expected ", fun->function->getArity(), " arguments, but got ", arity);
+			}
+
+			// the callee and its arguments replace the current frame, whose locals are dead now
+			closeUpvalue(frameBottom - 1);
+			std::copy(sp - arity - 1, sp, frameBottom - 1);
+			sp = frameBottom + arity;
+
+			STORE_STATE();
+			if (!reserveStack(fun->function->stackSlots - arity)) {
+				RUNTIME_ERROR("stack overflow");
+			}
+			activeClosure = fun;
+			ip = fun->function->getChunkPtr()->getInstructionPointer();
+			LOAD_STATE();
+			VM_BREAK;
+		}
+		VM_CASE(OP_SET_PROPERTY): {
+			objString* name = READ_STRING();
+			inlineCache& cache = caches[READ_SHORT()];
+			if (IS_OBJ(PEEK(1))) {
+				switch (AS_OBJ(PEEK(1))->getType()) {
 				case OBJ_INSTANCE: {
-					auto* instance = (objInstance*)AS_OBJ(peek(1));
-					auto* name = (objString*)AS_OBJ(activeClosure->function->getChunkPtr()->getConstant(ind));
-					value val = pop();
-					if (IS_NIL(val)) {
-						instance->tableDelete(name);
-					}
-					else {
-						instance->tableSet(name, val);
-					}
+					auto* instance = (objInstance*)AS_OBJ(PEEK(1));
+					value val = POP();
+					cachedSetProperty(cache, instance, name, val);
 					break;
 				}
 				case OBJ_CLASS: {
-					runtimeError("classes can't be modified");
-					return INTERPRET_RUNTIME_ERROR;
+					RUNTIME_ERROR("classes can't be modified");
 					break;
 				}
 				default:
-					runtimeError("only instances have properties");
-					return INTERPRET_RUNTIME_ERROR;
+					RUNTIME_ERROR("only instances have properties");
 					break;
 				}
 			}
 			else {
-				runtimeError("only instances have properties");
-				return INTERPRET_RUNTIME_ERROR;
+				RUNTIME_ERROR("only instances have properties");
 			}
-			break;
+			VM_BREAK;
 		}
-		case OP_GET_PROPERTY: {
-			short ind = readShort();
-			if (IS_OBJ(peek(0))) {
-				switch (AS_OBJ(peek(0))->getType()) {
+		VM_CASE(OP_GET_PROPERTY): {
+			objString* name = READ_STRING();
+			inlineCache& cache = caches[READ_SHORT()];
+			if (IS_OBJ(PEEK(0))) {
+				switch (AS_OBJ(PEEK(0))->getType()) {
 				case OBJ_INSTANCE: {
-					auto* instance = (objInstance*)AS_OBJ(peek(0));
-					auto* name = (objString*)AS_OBJ(activeClosure->function->getChunkPtr()->getConstant(ind));
-					value val = instance->tableGet(name);
-
-					pop();
-					push(val);
+					auto* instance = (objInstance*)AS_OBJ(PEEK(0));
+					PEEK_SET(0, cachedProperty(cache, instance, name));
 					break;
 				}
 				case OBJ_CLASS: {
-					auto* klass = (objClass*)AS_OBJ(peek(0));
-					auto* name = (objString*)AS_OBJ(activeClosure->function->getChunkPtr()->getConstant(ind));
-					value val = klass->tableGet(name);
-
-					pop();
-					push(val);
+					auto* klass = (objClass*)AS_OBJ(PEEK(0));
+					PEEK_SET(0, cachedMethod(cache, klass, name));
 					break;
 				}
 				default:
-					runtimeError("can only access objects");
-					return INTERPRET_RUNTIME_ERROR;
+					RUNTIME_ERROR("can only access objects");
 				}
 			}
 			else {
-				runtimeError("only instances have properties");
-				return INTERPRET_RUNTIME_ERROR;
+				RUNTIME_ERROR("only instances have properties");
 			}
-			break;
+			VM_BREAK;
 		}
-		case OP_CLASS: {
-			objString* klassName = (objString*)AS_OBJ(activeClosure->function->getChunkPtr()->getConstant(readShort()));
+		VM_CASE(OP_CLASS): {
+			objString* klassName = READ_STRING();
+			STORE_STATE();
 			objClass* klass = objClass::createObjClass(klassName);
-			push(OBJ_VAL(klass));
-			break;
+			PUSH(OBJ_VAL(klass));
+			VM_BREAK;
 		}
-		case OP_INHERIT: {
-			value superKlass = pop();
+		VM_CASE(OP_INHERIT): {
+			value superKlass = POP();
 			if (!(IS_OBJ(superKlass) && AS_OBJ(superKlass)->getType() == OBJ_CLASS)) {
-				runtimeError("can only inherit from other classes");
-				return INTERPRET_RUNTIME_ERROR;
+				RUNTIME_ERROR("can only inherit from other classes");
 			}
-			value klass = peek(0);
+			value klass = PEEK(0);
 			((objClass*)AS_OBJ(klass))->setSuperClass((objClass*)AS_OBJ(superKlass));
-			break;
+			VM_BREAK;
 		}
-		case OP_MEMBER_VARIABLE:
+		VM_CASE(OP_MEMBER_VARIABLE):
+			STORE_STATE();
 			if (!defineMemberVar())
 				return INTERPRET_RUNTIME_ERROR;
-			break;
-		case OP_METHOD: {
+			pc = ip;
+			sp = stackTop;
+			VM_BREAK;
+		VM_CASE(OP_METHOD): {
+			STORE_STATE();
 			defineMethod();
-			break;
+			pc = ip;
+			sp = stackTop;
+			VM_BREAK;
 		}
-		case OP_INVOKE:
+		VM_CASE(OP_INVOKE):
+			STORE_STATE();
 			if (!invoke())
 				return INTERPRET_RUNTIME_ERROR;
-			break;
-		case OP_LIST: {
-			push(OBJ_VAL(objList::createList()));
-			break;
+			LOAD_STATE();
+			VM_BREAK;
+		VM_CASE(OP_LIST): {
+			STORE_STATE();
+			PUSH(OBJ_VAL(objList::createList()));
+			VM_BREAK;
 		}
-		case OP_APPEND: {
-			size_t len = readSizeT();
-			objList* list = (objList*)AS_OBJ(peek(len));
+		VM_CASE(OP_APPEND): {
+			size_t len = READ_INT();
+			objList* list = (objList*)AS_OBJ(PEEK(len));
 
 			for (size_t i = 1; i <= len; i++)
 			{
-				value val = peek(len - i);
+				value val = PEEK(len - i);
 				list->appendValue(val);
 			}
 
-			for (size_t i = 0; i < len; i++) {
-				pop();
-			}
+			sp -= len;
 
-			break;
+			VM_BREAK;
 		}
-		case OP_GET_INDEX: {
-			value index = pop();
-			value list = peek(0);
+		VM_CASE(OP_GET_INDEX): {
+			value index = POP();
+			value list = PEEK(0);
 			if (!(IS_OBJ(list))) {
-				runtimeError("can only index '", list, "'");
-				return INTERPRET_RUNTIME_ERROR;
+				RUNTIME_ERROR("can only index '", list, "'");
 			}
+			STORE_STATE();
 			if (!getObjectIndex(AS_OBJ(list), index))
 				return INTERPRET_RUNTIME_ERROR;
-			break;
+			sp = stackTop;
+			VM_BREAK;
 		}
-		case OP_SET_INDEX: {
+		VM_CASE(OP_SET_INDEX): {
 
-			value val = pop();
-			value index = pop();
-			value list = peek(0);
+			// the operands stay on the stack, setting a dictionary key can collect garbage
+			value val = PEEK(0);
+			value index = PEEK(1);
+			value list = PEEK(2);
 			if (!(IS_OBJ(list))) {
-				runtimeError("can only index list and string objects");
-				return INTERPRET_RUNTIME_ERROR;
+				RUNTIME_ERROR("can only index list and string objects");
 			}
+			STORE_STATE();
 			if (!setObjectIndex(AS_OBJ(list), index, val))
 				return INTERPRET_RUNTIME_ERROR;
-			break;
+			sp -= 2;
+			VM_BREAK;
 		}
-		case OP_MAP: {
-			push(OBJ_VAL(objMap::createMap()));
-			break;
+		VM_CASE(OP_MAP): {
+			STORE_STATE();
+			PUSH(OBJ_VAL(objMap::createMap()));
+			VM_BREAK;
 		}
-		case OP_MAP_APPEND: {
-			size_t len = readSizeT();
-			objMap* map = (objMap*)AS_OBJ(peek(len * 2));
+		VM_CASE(OP_MAP_APPEND): {
+			size_t len = READ_INT();
+			objMap* map = (objMap*)AS_OBJ(PEEK(len * 2));
+			STORE_STATE();
 
 			for (size_t i = 1; i <= len * 2; i += 2)
 			{
-				value key = peek(len * 2 - i);
+				value key = PEEK(len * 2 - i);
 
-				value val = peek(len * 2 - i - 1);
+				value val = PEEK(len * 2 - i - 1);
 
 				map->insertElement(key, val);
 			}
 
-			for (size_t i = 0; i < len; i++) {
-				pop();
-				pop();
-			}
+			sp -= len * 2;
 
-			break;
+			VM_BREAK;
 		}
-		case OP_THIS: {
-			value this_val = activeCallFrameBottom[-1];
+		VM_CASE(OP_THIS): {
+			value this_val = frameBottom[-1];
 			if (!(IS_OBJ(this_val) && AS_OBJ(this_val)->getType() != OBJ_CLOSURE)) {
-				runtimeError("no valid 'this' object");
-				return INTERPRET_RUNTIME_ERROR;
+				RUNTIME_ERROR("no valid 'this' object");
 			}
-			push(this_val);
-			break;
+			PUSH(this_val);
+			VM_BREAK;
 		}
-		case OP_SUPER: {
-			auto name = (objString*)AS_OBJ(activeClosure->function->getChunkPtr()->getConstant(readShort()));
+		VM_CASE(OP_SUPER): {
+			auto name = READ_STRING();
 
 			//TODO: access activeFuncs superclass -- add class to methods
-			if (!activeClosure->function->isMethod()) {
-				runtimeError("no superclass");
-				return INTERPRET_RUNTIME_ERROR;
+			if (!closure->function->isMethod()) {
+				RUNTIME_ERROR("no superclass");
 			}
-			push(activeClosure->function->getClass()->superTableGet(name));
-			break;
+			PUSH(closure->function->getClass()->superTableGet(name));
+			VM_BREAK;
 		}
-		case OP_SUPER_INVOKE: {
+		VM_CASE(OP_SUPER_INVOKE): {
+			STORE_STATE();
 			if (!superInvoke())
 				return INTERPRET_RUNTIME_ERROR;
-			break;
+			LOAD_STATE();
+			VM_BREAK;
+		}
+		VM_CASE(OP_ADD_LOCAL_LOCAL): {
+			value a = frameBottom[READ_SHORT()];
+			value b = frameBottom[READ_SHORT()];
+			if (IS_NUM(a) && IS_NUM(b)) {
+				PUSH(addNumbers(a, b));
+				VM_BREAK;
+			}
+			PUSH(a);
+			PUSH(b);
+			STORE_STATE();
+			if (!add()) {
+				return INTERPRET_RUNTIME_ERROR;
+			}
+			sp = stackTop;
+			VM_BREAK;
+		}
+		/*
+		 * the fused compare-and-jump ops replace 'compare, OP_JUMP_IF_FALSE, OP_POP'.
+		 * when the condition holds nothing is left on the stack, otherwise a false
+		 * is pushed before jumping, because the jump target still pops the condition
+		 */
+		VM_CASE(OP_LESS_LOCAL_CONST_JUMP): {
+			value a = frameBottom[READ_SHORT()];
+			value b = READ_CONSTANT();
+			int offset = READ_SHORT();
+			if (!(IS_NUM(a) && IS_NUM(b))) {
+				RUNTIME_ERROR("can only use '<' on numbers");
+			}
+			if (!COMPARE_NUMBERS(a, b, <)) {
+				PUSH(FALSE_VAL);
+				pc += offset;
+			}
+			VM_BREAK;
+		}
+		VM_CASE(OP_LESS_LOCAL_LOCAL_JUMP): {
+			value a = frameBottom[READ_SHORT()];
+			value b = frameBottom[READ_SHORT()];
+			int offset = READ_SHORT();
+			if (!(IS_NUM(a) && IS_NUM(b))) {
+				RUNTIME_ERROR("can only use '<' on numbers");
+			}
+			if (!COMPARE_NUMBERS(a, b, <)) {
+				PUSH(FALSE_VAL);
+				pc += offset;
+			}
+			VM_BREAK;
+		}
+		VM_CASE(OP_LESS_EQUAL_LOCAL_LOCAL_JUMP): {
+			value a = frameBottom[READ_SHORT()];
+			value b = frameBottom[READ_SHORT()];
+			int offset = READ_SHORT();
+			if (!(IS_NUM(a) && IS_NUM(b))) {
+				RUNTIME_ERROR("can only use '<=' on numbers");
+			}
+			if (!COMPARE_NUMBERS(a, b, <=)) {
+				PUSH(FALSE_VAL);
+				pc += offset;
+			}
+			VM_BREAK;
 		}
-		case OP_IMPORT: {
-			value fileName = pop();
-			if (!(IS_OBJ(fileName) && AS_OBJ(fileName)->getType() == OBJ_STR)) {
-				runtimeError("importname must be a string");
+		VM_CASE(OP_GET_PROPERTY_THIS): {
+			objString* name = READ_STRING();
+			inlineCache& cache = caches[READ_SHORT()];
+			value this_val = frameBottom[-1];
+			if (!(IS_OBJ(this_val) && AS_OBJ(this_val)->getType() != OBJ_CLOSURE)) {
+				RUNTIME_ERROR("no valid 'this' object");
+			}
+			switch (AS_OBJ(this_val)->getType()) {
+			case OBJ_INSTANCE:
+				PUSH(cachedProperty(cache, (objInstance*)AS_OBJ(this_val), name));
+				break;
+			case OBJ_CLASS:
+				PUSH(cachedMethod(cache, (objClass*)AS_OBJ(this_val), name));
+				break;
+			default:
+				RUNTIME_ERROR("can only access objects");
+			}
+			VM_BREAK;
+		}
+		VM_CASE(OP_SET_LOCAL_POP): {
+			frameBottom[READ_SHORT()] = POP();
+			VM_BREAK;
+		}
+		/*
+		 * quickened instructions, they only check the operand types OP_ADD saw before.
+		 * if those change, they turn back into OP_ADD and execute that instead
+		 */
+		VM_CASE(OP_ADD_NUM): {
+			value b = PEEK(0);
+			value a = PEEK(1);
+			if (!(IS_NUM(a) && IS_NUM(b))) {
+				REWRITE_INSTRUCTION(OP_ADD);
+				pc--;
+				VM_BREAK;
+			}
+			sp--;
+			PEEK_SET(0, addNumbers(a, b));
+			VM_BREAK;
+		}
+		VM_CASE(OP_ADD_STR): {
+			if (!(IS_STR(PEEK(0)) && IS_STR(PEEK(1)))) {
+				REWRITE_INSTRUCTION(OP_ADD);
+				pc--;
+				VM_BREAK;
+			}
+			STORE_STATE();
+			if (!concatenateTwoStrings()) {
 				return INTERPRET_RUNTIME_ERROR;
 			}
+			sp = stackTop;
+			VM_BREAK;
+		}
+		/*
+		 * register instructions, see registerCompiler.hpp. they read their operands from
+		 * frame slots and constants and don't move the stack pointer. the compiler
+		 * emits OP_REG_SET_TOP before anything that uses the stack again
+		 */
+		VM_CASE(OP_REG_MOVE): {
+			int dst = READ_SHORT();
+			frameBottom[dst] = READ_OPERAND();
+			VM_BREAK;
+		}
+		VM_CASE(OP_REG_SET_TOP): {
+			sp = frameBottom + READ_SHORT();
+			VM_BREAK;
+		}
+		VM_CASE(OP_REG_ADD): {
+			int dst = READ_SHORT();
+			value a = READ_OPERAND();
+			value b = READ_OPERAND();
+			if (IS_NUM(a) && IS_NUM(b)) {
+				frameBottom[dst] = addNumbers(a, b);
+				VM_BREAK;
+			}
+			// the stack pointer is at dst here, so the GC sees everything below
+			PUSH(a);
+			PUSH(b);
+			STORE_STATE();
+			if (!add()) {
+				return INTERPRET_RUNTIME_ERROR;
+			}
+			sp = stackTop;
+			frameBottom[dst] = POP();
+			VM_BREAK;
+		}
+		VM_CASE(OP_REG_SUB): {
+			int dst = READ_SHORT();
+			value a = READ_OPERAND();
+			value b = READ_OPERAND();
+			if (!(IS_NUM(a) && IS_NUM(b)))
+				RUNTIME_ERROR("can't subtract '", b, "' from '", a, "'");
+			frameBottom[dst] = subNumbers(a, b);
+			VM_BREAK;
+		}
+		VM_CASE(OP_REG_MUL): {
+			int dst = READ_SHORT();
+			value a = READ_OPERAND();
+			value b = READ_OPERAND();
+			if (!(IS_NUM(a) && IS_NUM(b)))
+				RUNTIME_ERROR("can't multiply '", a, "' and '", b, "'");
+			frameBottom[dst] = mulNumbers(a, b);
+			VM_BREAK;
+		}
+		VM_CASE(OP_REG_DIV): {
+			int dst = READ_SHORT();
+			value a = READ_OPERAND();
+			value b = READ_OPERAND();
+			if (!(IS_NUM(a) && IS_NUM(b)))
+				RUNTIME_ERROR("can't divide '", a, "' by '", b, "'");
+			frameBottom[dst] = NUM_VAL(AS_NUM(a) / AS_NUM(b));
+			VM_BREAK;
+		}
+		VM_CASE(OP_REG_MODULO): {
+			int dst = READ_SHORT();
+			value a = READ_OPERAND();
+			value b = READ_OPERAND();
+			if (!(IS_NUM(a) && IS_NUM(b)))
+				RUNTIME_ERROR("can't get modulo of '", a, "' and '", b, "'");
+			frameBottom[dst] = moduloValues(a, b);
+			VM_BREAK;
+		}
+		// like the fused compare-and-jump ops, false is pushed when jumping, the target pops it
+		VM_CASE(OP_REG_JUMP_IF_NOT_LESSER): {
+			value a = READ_OPERAND();
+			value b = READ_OPERAND();
+			int offset = READ_SHORT();
+			if (!(IS_NUM(a) && IS_NUM(b))) {
+				RUNTIME_ERROR("can only use '<' on numbers");
+			}
+			if (!COMPARE_NUMBERS(a, b, <)) {
+				PUSH(FALSE_VAL);
+				pc += offset;
+			}
+			VM_BREAK;
+		}
+		VM_CASE(OP_REG_JUMP_IF_NOT_LESSER_OR_EQUALS): {
+			value a = READ_OPERAND();
+			value b = READ_OPERAND();
+			int offset = READ_SHORT();
+			if (!(IS_NUM(a) && IS_NUM(b))) {
+				RUNTIME_ERROR("can only use '<=' on numbers");
+			}
+			if (!COMPARE_NUMBERS(a, b, <=)) {
+				PUSH(FALSE_VAL);
+				pc += offset;
+			}
+			VM_BREAK;
+		}
+		VM_CASE(OP_REG_JUMP_IF_NOT_GREATER): {
+			value a = READ_OPERAND();
+			value b = READ_OPERAND();
+			int offset = READ_SHORT();
+			if (!(IS_NUM(a) && IS_NUM(b))) {
+				RUNTIME_ERROR("can only use '>' on numbers");
+			}
+			if (!COMPARE_NUMBERS(a, b, >)) {
+				PUSH(FALSE_VAL);
+				pc += offset;
+			}
+			VM_BREAK;
+		}
+		VM_CASE(OP_REG_JUMP_IF_NOT_GREATER_OR_EQUALS): {
+			value a = READ_OPERAND();
+			value b = READ_OPERAND();
+			int offset = READ_SHORT();
+			if (!(IS_NUM(a) && IS_NUM(b))) {
+				RUNTIME_ERROR("can only use '>=' on numbers");
+			}
+			if (!COMPARE_NUMBERS(a, b, >=)) {
+				PUSH(FALSE_VAL);
+				pc += offset;
+			}
+			VM_BREAK;
+		}
+		VM_CASE(OP_REG_JUMP_IF_NOT_EQUALS): {
+			value a = READ_OPERAND();
+			value b = READ_OPERAND();
+			int offset = READ_SHORT();
+			if (!areEqual(b, a)) {
+				PUSH(FALSE_VAL);
+				pc += offset;
+			}
+			VM_BREAK;
+		}
+		VM_CASE(OP_REG_JUMP_IF_NOT_NOT_EQUALS): {
+			value a = READ_OPERAND();
+			value b = READ_OPERAND();
+			int offset = READ_SHORT();
+			if (areEqual(b, a)) {
+				PUSH(FALSE_VAL);
+				pc += offset;
+			}
+			VM_BREAK;
+		}
+		VM_CASE(OP_IMPORT): {
+			value fileName = POP();
+			if (!(IS_OBJ(fileName) && AS_OBJ(fileName)->getType() == OBJ_STR)) {
+				RUNTIME_ERROR("importname must be a string");
+			}
 			auto fileNameStr = (objString*)AS_OBJ(fileName);
-			auto prevIP = ip;
+			auto prevIP = pc;
+			STORE_STATE();
 			if (!importFile(fileNameStr->getChars()))
 				return INTERPRET_RUNTIME_ERROR;
-			ip = prevIP;
+			LOAD_STATE();
+			pc = prevIP;
 
-			break;
+			VM_BREAK;
+		}
+		VM_CASE(OP_REG_RETURN): {
+			value retVal = READ_OPERAND();
+			PUSH(retVal);
 		}
-		case OP_RETURN:
+			// falls through, OP_RETURN pops the value again
+		VM_CASE(OP_RETURN):
 			if (callDepth == 0) {
+				STORE_STATE();
 				return INTERPRET_OK;
 			}
 			else {
-				value retVal = pop();
-				closeUpvalue(activeCallFrameBottom);
+				value retVal = POP();
+				closeUpvalue(frameBottom);
 				callDepth--;
 				activeCallFrameBottom = callFrames[callDepth].bottom;
-				stackTop = callFrames[callDepth].top;
 				activeClosure = callFrames[callDepth].closure;
-				pop(); // popping the callee
+				sp = callFrames[callDepth].top;
+				sp--; // popping the callee
 				//uintptr_t returnAddress = ((objFunction*)(tmpRetAdd.as.object))->retAddress;
 				ip = callFrames[callDepth].returnPtr;
+				stackTop = sp;
+				LOAD_STATE();
 
-				push(retVal);
+				PUSH(retVal);
 			}
-			break;
+			VM_BREAK;
 		}
 	}
 }
@@ -1254,6 +1976,11 @@ bool VM::runtimeError(const char* msg, Ts... args) {
 		auto prevName = activeClosure->function->name->getChars();
 
 		for (size_t i = callDepth - 1; i > 0; i--) {
+			// deep recursion would print thousands of lines
+			if (callDepth - i > TRACEBACK_MAX) {
+				std::cerr << "... " << i << " more calls" << std::endl;
+				break;
+			}
 			std::cerr << prevName << " <- " << callFrames[i].closure->function->name->getChars() << std::endl;
 			prevName = callFrames[i].closure->function->name->getChars();
 		}
@@ -1,10 +1,28 @@
 #include "../../header/virtualMachine/chunk.hpp"
 
+#include "../../header/virtualMachine/obj.hpp"
+
+#include <algorithm>
+
 void chunk::addByte(char byte, unsigned int line) {
     lines.push_back(line);
     code.push_back(byte);
 }
 
+void chunk::addShort(uint16_t val, unsigned int line) {
+    char bytes[sizeof(val)];
+    encodeShort(bytes, val);
+    for (char byte : bytes)
+        addByte(byte, line);
+}
+
+void chunk::addInt(uint32_t val, unsigned int line) {
+    char bytes[sizeof(val)];
+    encodeInt(bytes, val);
+    for (char byte : bytes)
+        addByte(byte, line);
+}
+
 unsigned int chunk::addConstantGetLine(value constant, unsigned int line) {
     constants.push_back(constant);
     size_t index = constants.size() - 1;
@@ -20,14 +38,229 @@ void chunk::writeConstant(value constant, unsigned int line) {
     constants.push_back(constant);
     size_t index = constants.size() - 1;
     if(index > UINT16_MAX) {
-        //TODO: error if too much constants
+        addByte(OP_CONSTANT_WIDE, line);
+        addInt(index, line);
         return;
     }
     addByte(OP_CONSTANT, line);
-    addByte(char(index >> 8) & 0xff, line);
-    addByte(char(index) & 0xff, line);
+    addShort(index, line);
 }
 
 char& chunk::accessAt(size_t pos) {
     return code.at(pos);
-}
\ No newline at end of file
+}
+
+void chunk::removeBytes(const std::vector<size_t> &positions) {
+    if (positions.empty())
+        return;
+    size_t to = positions.front();
+    for (size_t i = 0; i < positions.size(); i++) {
+        size_t end = i + 1 < positions.size() ? positions[i + 1] : code.size();
+        for (size_t from = positions[i] + 1; from < end; from++, to++) {
+            code[to] = code[from];
+            lines[to] = lines[from];
+        }
+    }
+    code.resize(to);
+    lines.resize(to);
+}
+
+void chunk::replaceCode(std::vector<char> &&newCode, std::vector<unsigned int> &&newLines) {
+    code = std::move(newCode);
+    lines = std::move(newLines);
+}
+
+size_t chunk::instructionLength(size_t offset) const {
+    switch ((unsigned char)code.at(offset)) {
+    case OP_CONSTANT:
+    case OP_INCREMENT_GLOBAL:
+    case OP_DECREMENT_GLOBAL:
+    case OP_INCREMENT_LOCAL:
+    case OP_DECREMENT_LOCAL:
+    case OP_DEFINE_GLOBAL:
+    case OP_GET_GLOBAL:
+    case OP_SET_GLOBAL:
+    case OP_GET_LOCAL:
+    case OP_SET_LOCAL:
+    case OP_GET_UPVALUE:
+    case OP_SET_UPVALUE:
+    case OP_JUMP:
+    case OP_JUMP_IF_FALSE:
+    case OP_LOOP:
+    case OP_CLASS:
+    case OP_MEMBER_VARIABLE:
+    case OP_METHOD:
+    case OP_SUPER:
+    case OP_SET_LOCAL_POP:
+    case OP_REG_SET_TOP:
+    case OP_REG_RETURN:
+        return 3;
+    case OP_CALL:
+    case OP_TAIL_CALL:
+    case OP_CONCAT_N:
+        return 2;
+    case OP_GET_PROPERTY:
+    case OP_SET_PROPERTY:
+    case OP_GET_PROPERTY_THIS:
+        return 5;
+    case OP_INVOKE:
+    case OP_SUPER_INVOKE:
+        return 6;
+    case OP_ADD_LOCAL_LOCAL:
+    case OP_REG_MOVE:
+        return 5;
+    case OP_LESS_LOCAL_CONST_JUMP:
+    case OP_LESS_LOCAL_LOCAL_JUMP:
+    case OP_LESS_EQUAL_LOCAL_LOCAL_JUMP:
+    case OP_REG_ADD:
+    case OP_REG_SUB:
+    case OP_REG_MUL:
+    case OP_REG_DIV:
+    case OP_REG_MODULO:
+    case OP_REG_JUMP_IF_NOT_LESSER:
+    case OP_REG_JUMP_IF_NOT_LESSER_OR_EQUALS:
+    case OP_REG_JUMP_IF_NOT_GREATER:
+    case OP_REG_JUMP_IF_NOT_GREATER_OR_EQUALS:
+    case OP_REG_JUMP_IF_NOT_EQUALS:
+    case OP_REG_JUMP_IF_NOT_NOT_EQUALS:
+        return 7;
+    case OP_CONSTANT_WIDE:
+    case OP_JUMP_WIDE:
+    case OP_JUMP_IF_FALSE_WIDE:
+    case OP_LOOP_WIDE:
+    case OP_APPEND:
+    case OP_MAP_APPEND:
+        return 5;
+    case OP_CLOSURE: {
+        // followed by an isLocal and index byte for every upvalue
+        auto function = (objFunction*)AS_OBJ(constants.at(readShortAt(offset + 1)));
+        return 3 + 2 * function->upvalueCount;
+    }
+    default:
+        return 1;
+    }
+}
+bool chunk::stackEffect(size_t offset, long& effect) const {
+    switch ((unsigned char)code.at(offset)) {
+    case OP_CONSTANT:
+    case OP_CONSTANT_WIDE:
+    case OP_TRUE:
+    case OP_FALSE:
+    case OP_NIL:
+    case OP_GET_GLOBAL:
+    case OP_GET_LOCAL:
+    case OP_GET_UPVALUE:
+    case OP_CLOSURE:
+    case OP_CLASS:
+    case OP_LIST:
+    case OP_MAP:
+    case OP_THIS:
+    case OP_SUPER:
+        effect = 1;
+        return true;
+    case OP_NEGATE:
+    case OP_NOT:
+    case OP_BIT_NOT:
+    case OP_INCREMENT_GLOBAL:
+    case OP_DECREMENT_GLOBAL:
+    case OP_INCREMENT_LOCAL:
+    case OP_DECREMENT_LOCAL:
+    case OP_CASE_COMPARE:
+    case OP_SET_GLOBAL:
+    case OP_SET_LOCAL:
+    case OP_SET_UPVALUE:
+    case OP_GET_PROPERTY:
+    case OP_JUMP:
+    case OP_JUMP_WIDE:
+    case OP_JUMP_IF_FALSE:
+    case OP_JUMP_IF_FALSE_WIDE:
+    case OP_LOOP:
+    case OP_LOOP_WIDE:
+        effect = 0;
+        return true;
+    case OP_ADD:
+    case OP_SUB:
+    case OP_MUL:
+    case OP_DIV:
+    case OP_MODULO:
+    case OP_EQUALS:
+    case OP_NOT_EQUALS:
+    case OP_LESSER:
+    case OP_LESSER_OR_EQUALS:
+    case OP_GREATER:
+    case OP_GREATER_OR_EQUALS:
+    case OP_BIT_AND:
+    case OP_BIT_OR:
+    case OP_BIT_SHIFT_LEFT:
+    case OP_BIT_SHIFT_RIGHT:
+    case OP_BIT_XOR:
+    case OP_DEFINE_GLOBAL:
+    case OP_POP:
+    case OP_CLOSE_UPVALUE:
+    case OP_SET_PROPERTY:
+    case OP_INHERIT:
+    case OP_MEMBER_VARIABLE:
+    case OP_METHOD:
+    case OP_GET_INDEX:
+    case OP_IMPORT:
+    case OP_RETURN:
+        effect = -1;
+        return true;
+    case OP_SET_INDEX:
+        effect = -2;
+        return true;
+    case OP_CALL:
+    case OP_TAIL_CALL:
+        effect = -long((unsigned char)code.at(offset + 1));
+        return true;
+    case OP_CONCAT_N:
+        effect = 1 - long((unsigned char)code.at(offset + 1));
+        return true;
+    case OP_INVOKE:
+    case OP_SUPER_INVOKE:
+        effect = -long((unsigned char)code.at(offset + 3));
+        return true;
+    case OP_APPEND:
+    case OP_MAP_APPEND: {
+        size_t len = readIntAt(offset + 1);
+        effect = -long((unsigned char)code.at(offset) == OP_APPEND ? len : len * 2);
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+
+size_t chunk::maxStackDepth(size_t arity) const {
+    size_t size = code.size();
+    // the depth at every forward jump target, -1 while no jump to it was seen
+    std::vector<long> targetDepth(size + 1, -1);
+    long depth = long(arity);
+    long maxDepth = depth;
+    bool reachable = true;
+
+    for (size_t offset = 0; offset < size; offset += instructionLength(offset)) {
+        if (targetDepth[offset] >= 0) {
+            depth = reachable ? std::max(depth, targetDepth[offset]) : targetDepth[offset];
+            reachable = true;
+        }
+
+        unsigned char op = (unsigned char)code.at(offset);
+        long effect;
+        // opcodes of the optimization passes don't show up here, count them as a push to be safe
+        if (!stackEffect(offset, effect))
+            effect = 1;
+        depth = std::max(depth + effect, 0L);
+        maxDepth = std::max(maxDepth, depth);
+
+        if (op == OP_JUMP || op == OP_JUMP_WIDE || op == OP_JUMP_IF_FALSE || op == OP_JUMP_IF_FALSE_WIDE) {
+            bool wide = op == OP_JUMP_WIDE || op == OP_JUMP_IF_FALSE_WIDE;
+            size_t target = offset + instructionLength(offset) + (wide ? readIntAt(offset + 1) : readShortAt(offset + 1));
+            if (target <= size)
+                targetDepth[target] = std::max(targetDepth[target], depth);
+        }
+        if (op == OP_JUMP || op == OP_JUMP_WIDE || op == OP_LOOP || op == OP_LOOP_WIDE || op == OP_RETURN)
+            reachable = false;
+    }
+    return size_t(maxDepth);
+}
@@ -2,12 +2,33 @@
 
 #include "../../header/virtualMachine/VM.hpp"
 
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <new>
 
-memoryManager::memoryManager(VM& v) : vm(&v), initString(objString::copyString("init", 4)) {}
 
-memoryManager::memoryManager() : vm(nullptr), initString(objString::copyString("init", 4)) {}
+memoryManager::memoryManager(VM& v) : vm(&v), initString(objString::copyString("init", 4)) {
+	createStringCaches();
+}
+
+memoryManager::memoryManager() : vm(nullptr), initString(objString::copyString("init", 4)) {
+	createStringCaches();
+}
+
+void memoryManager::createStringCaches() {
+	for (size_t i = 0; i < 256; i++) {
+		char chr = char(i);
+		charStrings[i] = objString::copyString(&chr, 1);
+	}
+	for (size_t i = 0; i < SMALL_INT_STRINGS; i++) {
+		std::string number = std::to_string(i);
+		intStrings[i] = objString::copyString(number.data(), number.size());
+	}
+}
 
 memoryManager::~memoryManager() {
+	promoteAll();
 	obj* object = allObjects;
 
 	// std::cout << " -- before memory manager destroyed: " << bytesAllocated << std::endl;
@@ -21,23 +42,47 @@ memoryManager::~memoryManager() {
 	// std::cout << " -- memory manager destroyed: " << bytesAllocated << std::endl;
 }
 
+objString* memoryManager::findInterned(std::string_view first, std::string_view second, uint32_t hash) {
+	auto interned = internedStrings.findAs(first, hash, [second](std::string_view first, const objString* str) {
+		return first.size() + second.size() == str->len
+			&& memcmp(first.data(), str->chars, first.size()) == 0
+			&& memcmp(second.data(), str->chars + first.size(), second.size()) == 0;
+	});
+	return interned == internedStrings.end() ? nullptr : interned->first;
+}
+
+objString* memoryManager::allocateString(unsigned int len) {
+	collectIfNeeded();
+
+	size_t size = sizeof(objString) + len + 1;
+	auto* str = new (::operator new(size)) objString();
+	str->chars = (char*)(str + 1);
+	str->len = len;
+	str->chars[len] = '\0';
+
+	addToObjects(str);
+	bytesAllocated += size;
+	youngBytes += size;
+	return str;
+}
+
 void memoryManager::setVM(VM* v) {
 	this->vm = v;
 }
 
 void memoryManager::addToObjects(obj* o) {
-	o->next = allObjects;
-	allObjects = o;
+	o->next = youngObjects;
+	youngObjects = o;
 }
 
 void memoryManager::freeObject(obj* el) {
 	switch (el->type) {
 	case OBJ_STR: {
 		auto str = (objString*)el;
-		// const char* tmpArr = str->getChars();
-		bytesAllocated -= sizeof(objString);
-		freeArray(str->getChars(), str->getLen() + 1);
-		delete str;
+		// a view only owns the object, its characters belong to the parent
+		bytesAllocated -= sizeof(objString) + (str->parent == nullptr ? str->getLen() + 1 : 0);
+		str->~objString();
+		::operator delete(str);
 		break;
 	}
 	case OBJ_FUN: {
@@ -79,6 +124,12 @@ void memoryManager::freeObject(obj* el) {
 		delete file;
 		break;
 	}
+	case OBJ_STRING_BUILDER: {
+		auto* builder = (objStringBuilder*)el;
+		bytesAllocated -= sizeof(objStringBuilder) + builder->buffer.capacity();
+		delete builder;
+		break;
+	}
 	case OBJ_MAP: {
 		bytesAllocated -= sizeof(objMap);
 		auto* map = (objMap*)el;
@@ -102,7 +153,19 @@ void memoryManager::freeObject(obj* el) {
 
 void memoryManager::markObject(obj* obj) {
 	if (obj == nullptr) return;
+#ifdef DEBUG_STRESS_GC
+	if (verifyingBarriers) {
+		if (!obj->isOld && !obj->isMarked) {
+			std::cerr << "missing write barrier: an old object references the unmarked young object " << obj
+				<< " of type " << int(obj->getType()) << std::endl;
+			abort();
+		}
+		return;
+	}
+#endif
 	if (obj->isMarked) return;
+	// a minor collection doesn't trace old objects, the remembered set covers their references to young ones
+	if (collectingYoung && obj->isOld) return;
 
 	obj->mark();
 	grayStack.push_back(obj);
@@ -138,8 +201,10 @@ void memoryManager::markRoots() {
 
 	// marking all globals
 	for (auto& el : vm->globals) {
-		markObject(el.first);
-		markValue(el.second);
+		markValue(el);
+	}
+	for (auto& el : vm->globalNames) {
+		markObject(el);
 	}
 
 	markObject(vm->activeClosure);
@@ -148,13 +213,21 @@ void memoryManager::markRoots() {
 		markObject(el);
 	}
 
-	markObject(vm->stringClass);
-
-	//markObject(vm->arrayClass);
-
-	//markObject(vm->fileClass);
+	for (auto* klass : vm->builtinClasses) {
+		markObject(klass);
+	}
 
 	markObject(initString);
+	for (auto* str : charStrings) {
+		markObject(str);
+	}
+	for (auto* str : intStrings) {
+		markObject(str);
+	}
+
+	for (auto* el : temporaryRoots) {
+		markObject(el);
+	}
 }
 
 void memoryManager::blackenObject(obj* obj) {
@@ -167,6 +240,19 @@ void memoryManager::blackenObject(obj* obj) {
 			markObject(el.first);
 			markValue(el.second);
 		}
+		for (auto& el : cl->initialFields) {
+			markValue(el);
+		}
+		// the field names of all shapes, a transition must never match a new string at the same address
+		std::vector<shape*> shapes{ cl->rootShape };
+		while (!shapes.empty()) {
+			shape* current = shapes.back();
+			shapes.pop_back();
+			for (auto& transition : current->transitions) {
+				markObject(transition.first);
+				shapes.push_back(transition.second);
+			}
+		}
 		break;
 	}
 	case OBJ_FUN: {
@@ -176,21 +262,32 @@ void memoryManager::blackenObject(obj* obj) {
 		for (auto& el : fn->funChunk->constants) {
 			markValue(el);
 		}
+		// a collected class could be reallocated at the same address and hit its old entries.
+		// filling an entry has no write barrier, collectYoung invalidates all caches instead when a young class dies
+#ifdef DEBUG_STRESS_GC
+		if (verifyingBarriers) break;
+#endif
+		for (auto& cache : fn->funChunk->caches) {
+			for (auto& entry : cache.entries) {
+				markObject(entry.klass);
+				markValue(entry.method);
+			}
+		}
 		break;
 	}
 	case OBJ_INSTANCE: {
 		auto* cl = (objInstance*)obj;
 		markObject(cl->klass);
-		for (auto& el : cl->table) {
-			markObject(el.first);
-			markValue(el.second);
+		for (auto& el : cl->fields) {
+			markValue(el);
 		}
 		break;
 	}
 	case OBJ_LIST: {
 		objList* list = (objList*)obj;
-		for (auto& el : list->data) {
-			markValue(el);
+		// an old list is only traced by a minor collection because it is remembered
+		for (size_t i = collectingYoung ? list->rememberedFrom : 0; i < list->data.size(); i++) {
+			markValue(list->data[i]);
 		}
 		break;
 	}
@@ -215,19 +312,22 @@ void memoryManager::blackenObject(obj* obj) {
 		}
 		break;
 	}
-	case OBJ_NAT_FUN:
 	case OBJ_STR:
+		markObject(((objString*)obj)->parent);
+		break;
+	case OBJ_NAT_FUN:
 	case OBJ_FILE:
+	case OBJ_STRING_BUILDER:
 		break;
 	}
 }
 
 void memoryManager::traceReferences() {
-	do {
-		obj* object = grayStack.at(grayStack.size() - 1);
+	while (!grayStack.empty()) {
+		obj* object = grayStack.back();
 		grayStack.pop_back();
 		blackenObject(object);
-	} while (grayStack.size() > 0);
+	}
 
 
 	/*
@@ -241,17 +341,7 @@ void memoryManager::traceReferences() {
 }
 
 void memoryManager::stringsRemoveWhite() {
-	std::vector<const char*> tmp;
-
-	for (const auto& el : internedStrings) {
-		if (!el.second->isMark()) {
-			tmp.push_back(el.first);
-		}
-	}
-
-	for (const auto& el : tmp) {
-		internedStrings.erase(el);
-	}
+	internedStrings.removeIf([](const auto& el) { return !el.first->isMark(); });
 }
 
 void memoryManager::sweep() {
@@ -293,6 +383,116 @@ void memoryManager::sweep() {
 #endif
 }
 
+void memoryManager::sweepYoung() {
+
+#ifdef DEBUG_LOG_GC
+	size_t freedNum = 0;
+#endif
+
+	obj* object = youngObjects;
+	while (object != nullptr) {
+		obj* next = object->next;
+		if (object->isMarked) {
+			object->isMarked = false;
+			object->isOld = true;
+			object->next = allObjects;
+			allObjects = object;
+		}
+		else {
+			if (object->type == OBJ_STR && ((objString*)object)->interned) {
+				internedStrings.erase((objString*)object);
+			}
+			// old functions may still have it in their inline caches
+			if (object->type == OBJ_CLASS) {
+				objClass::generation++;
+			}
+
+#ifdef DEBUG_LOG_GC
+			std::cout << "freed: " << object << std::endl;
+			freedNum++;
+#endif
+
+			freeObject(object);
+		}
+		object = next;
+	}
+	youngObjects = nullptr;
+
+#ifdef DEBUG_LOG_GC
+	std::cout << "young objects freed: " << freedNum << std::endl;
+#endif
+}
+
+void memoryManager::promoteAll() {
+	while (youngObjects != nullptr) {
+		obj* next = youngObjects->next;
+		youngObjects->isOld = true;
+		youngObjects->next = allObjects;
+		allObjects = youngObjects;
+		youngObjects = next;
+	}
+	for (obj* object : rememberedSet) {
+		object->isRemembered = false;
+	}
+	rememberedSet.clear();
+	youngBytes = 0;
+}
+
+#ifdef DEBUG_STRESS_GC
+
+void memoryManager::verifyBarriers() {
+	verifyingBarriers = true;
+	for (obj* object = allObjects; object != nullptr; object = object->next) {
+		blackenObject(object);
+	}
+	verifyingBarriers = false;
+}
+
+#endif
+
+#ifdef DEBUG_TABLE_STATS
+
+// sums up the stats of several tables, the average is weighted by their entries
+static void addTableStats(tableStats& sum, const tableStats& stats) {
+	double probes = sum.averageProbe * sum.count + stats.averageProbe * stats.count;
+	sum.count += stats.count;
+	sum.capacity += stats.capacity;
+	sum.maxProbe = std::max(sum.maxProbe, stats.maxProbe);
+	sum.averageProbe = sum.count == 0 ? 0 : probes / sum.count;
+}
+
+static void printStatsLine(const char* name, size_t tables, const tableStats& stats) {
+	std::cerr << "  " << name << ": " << tables << " tables, " << stats.count << " entries in "
+		<< stats.capacity << " slots, average probe " << stats.averageProbe << ", longest " << stats.maxProbe << std::endl;
+}
+
+void memoryManager::printTableStats() {
+	tableStats members, methods, maps;
+	size_t classCount = 0, mapCount = 0;
+	promoteAll();
+	for (obj* object = allObjects; object != nullptr; object = object->next) {
+		if (object->getType() == OBJ_CLASS) {
+			auto* klass = (objClass*)object;
+			addTableStats(members, klass->table.probeStats());
+			addTableStats(methods, klass->methods.probeStats());
+			classCount++;
+		}
+		else if (object->getType() == OBJ_MAP) {
+			addTableStats(maps, ((objMap*)object)->data.probeStats());
+			mapCount++;
+		}
+	}
+
+	std::cerr << " == hash tables ==" << std::endl;
+	printStatsLine("interned strings", 1, internedStrings.probeStats());
+	printStatsLine("globals", 1, vm->globalSlots.probeStats());
+	printStatsLine("class members", classCount, members);
+	printStatsLine("flattened methods", classCount, methods);
+	printStatsLine("maps", mapCount, maps);
+}
+
+#endif
+
 void memoryManager::collectGarbage() {
 	//stopping if vm is not created yet
 	if (!(vm != nullptr && vm->gcReady)) {
@@ -300,12 +500,13 @@ void memoryManager::collectGarbage() {
 	}
 
 
-	size_t before = bytesAllocated;
 #ifdef DEBUG_LOG_GC
 	std::cout << " -- GC started:" << std::endl;
 	size_t before = bytesAllocated;
 #endif
 
+	// the young objects are collected like the old ones
+	promoteAll();
 
 	markRoots();
 	traceReferences();
@@ -321,6 +522,38 @@ void memoryManager::collectGarbage() {
 #endif
 }
 
+void memoryManager::collectYoung() {
+	if (!(vm != nullptr && vm->gcReady)) {
+		return;
+	}
+
+#ifdef DEBUG_LOG_GC
+	std::cout << " -- minor GC started:" << std::endl;
+	size_t before = bytesAllocated;
+#endif
+
+	collectingYoung = true;
+	markRoots();
+	for (obj* object : rememberedSet) {
+		object->isRemembered = false;
+		blackenObject(object);
+	}
+	rememberedSet.clear();
+	traceReferences();
+	collectingYoung = false;
+
+#ifdef DEBUG_STRESS_GC
+	verifyBarriers();
+#endif
+
+	sweepYoung();
+	youngBytes = 0;
+
+#ifdef DEBUG_LOG_GC
+	std::cout << " -- end minor GC: from " << before << " to " << bytesAllocated << std::endl;
+#endif
+}
+
 size_t memoryManager::getHeapSize() {
 	return bytesAllocated;
 }
\ No newline at end of file
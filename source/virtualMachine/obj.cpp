@@ -11,38 +11,72 @@ objString::objString() : len(0), chars(nullptr) {
 	type = OBJ_STR;
 }
 
-void objString::init(const char* ch, unsigned int strlen) {
-	len = strlen;
+objString* objString::copyString(const char* chars, const unsigned int len) {
+	uint32_t hash = hashChars(chars, len);
+	objString* interned = globalMemory.findInterned(std::string_view(chars, len), {}, hash);
+	if (interned != nullptr) {
+		return interned;
+	}
 
-	char* str = globalMemory.allocateArray<char>(len + 1);
-	memcpy(str, ch, len);
-	str[len] = '\0';
+	objString* str = globalMemory.allocateString(len);
+	memcpy(str->chars, chars, len);
+	str->hash = hash;
+	str->hashed = true;
+	str->interned = true;
+	globalMemory.internedStrings.insert(str, noValue{});
+	return str;
+}
 
-	chars = str;
+objString* objString::createString(const char* chars, const unsigned int len) {
+	objString* str = globalMemory.allocateString(len);
+	memcpy(str->chars, chars, len);
+	return str;
 }
 
-objString* objString::copyString(const char* chars, const unsigned int len) {
-	//TODO: eliminate unnecessary new & delete
-	char* tmp = globalMemory.allocateArray<char>(len + 1);
-	memcpy(tmp, chars, len);
-	tmp[len] = '\0';
-
-	if (globalMemory.internedStrings.count(tmp)) {
-		objString* ret = globalMemory.internedStrings.at(tmp);
-		globalMemory.freeArray(tmp, len + 1);
-		return ret;
+objString* objString::copyRuntimeString(const char* chars, const unsigned int len) {
+	if (len > STRING_INTERN_LIMIT) {
+		return createString(chars, len);
+	}
+	return copyString(chars, len);
+}
+
+objString* objString::concatenate(const value* parts, size_t count, size_t len) {
+	if (len <= STRING_INTERN_LIMIT) {
+		// short enough to be interned, so it's put together here and only allocated if it's new
+		char chars[STRING_INTERN_LIMIT];
+		size_t pos = 0;
+		for (size_t i = 0; i < count; i++) {
+			objString* part = AS_STR(parts[i]);
+			memcpy(chars + pos, part->chars, part->len);
+			pos += part->len;
+		}
+		return copyString(chars, len);
 	}
 
-	globalMemory.freeArray(tmp, len + 1);
-
-	auto* str = (objString*)globalMemory.allocateObject<objString>();
-	str->mark();
-	str->init(chars, len);
-	globalMemory.internedStrings.insert_or_assign(str->chars, str);
-	str->unmark();
+	objString* str = globalMemory.allocateString(len);
+	char* pos = str->chars;
+	for (size_t i = 0; i < count; i++) {
+		objString* part = AS_STR(parts[i]);
+		memcpy(pos, part->chars, part->len);
+		pos += part->len;
+	}
 	return str;
 }
 
+objString* objString::createView(objString* str, size_t offset, const unsigned int len) {
+	// a view of a view shares the characters of the original string, so no chain of parents builds up
+	if (str->parent != nullptr) {
+		offset += str->chars - str->parent->chars;
+		str = str->parent;
+	}
+
+	auto* view = globalMemory.allocateObject<objString>();
+	view->chars = str->chars + offset;
+	view->len = len;
+	view->parent = str;
+	return view;
+}
+
 objString* objString::copyStringEscape(const char* chars, const unsigned int len) {
 	char* tmp = new char[len + 1];
 	
@@ -82,44 +116,35 @@ objString* objString::copyStringEscape(const char* chars, const unsigned int len
 			pos++;
 		}
 	}
-	char* escapedStr = globalMemory.allocateArray<char>(newLen + 1);
-	memcpy(escapedStr, tmp, newLen);
-	escapedStr[newLen] = '\0';
-	delete[] tmp;
-	tmp = escapedStr;
-
-	if (globalMemory.internedStrings.count(tmp)) {
-		objString* ret = globalMemory.internedStrings.at(tmp);
-		globalMemory.freeArray(tmp, newLen + 1);
-		return ret;
-	}
 
-
-	auto* str = (objString*)globalMemory.allocateObject<objString>();
-	str->mark();
-	str->init(tmp, newLen);
-	globalMemory.internedStrings.insert_or_assign(str->chars, str);
-	str->unmark();
-
-	globalMemory.freeArray(tmp, newLen + 1);
+	objString* str = copyString(tmp, newLen);
+	delete[] tmp;
 	return str;
 }
 
-objString* objString::takeString(char* chars, const unsigned int len) {
-
-	auto interned = globalMemory.internedStrings.find(chars);
+objString* objString::concatenate(objString* a, objString* b) {
+	// a and b stay reachable, so they can be passed as views while a new string is allocated
+	std::string_view first(a->chars, a->len), second(b->chars, b->len);
+	bool intern = first.size() + second.size() <= STRING_INTERN_LIMIT;
 
-	if (interned != globalMemory.internedStrings.end()) {
-		globalMemory.freeArray(chars, len + 1);
-		return interned->second;
+	uint32_t hash = 0;
+	if (intern) {
+		hash = hashChars(second.data(), second.size(), a->getHash());
+		objString* interned = globalMemory.findInterned(first, second, hash);
+		if (interned != nullptr) {
+			return interned;
+		}
 	}
 
-	auto* str = (objString*)globalMemory.allocateObject<objString>();
-	str->mark();
-	str->chars = chars;
-	str->len = len;
-	globalMemory.internedStrings.insert_or_assign(str->chars, str);
-	str->unmark();
+	objString* str = globalMemory.allocateString(a->len + b->len);
+	memcpy(str->chars, first.data(), first.size());
+	memcpy(str->chars + first.size(), second.data(), second.size());
+	if (intern) {
+		str->hash = hash;
+		str->hashed = true;
+		str->interned = true;
+		globalMemory.internedStrings.insert(str, noValue{});
+	}
 	return str;
 }
 
@@ -148,6 +173,10 @@ bool obj::isMark() {
 	return isMarked;
 }
 
+void obj::remember() {
+	globalMemory.remember(this);
+}
+
 
 
 ///object function
@@ -164,6 +193,7 @@ objFunction* objFunction::createObjFunction(objString* name, chunk* ch, int arit
 }
 
 void objFunction::setClass(objClass* cl) {
+	writeBarrier(cl);
 	klass = cl;
 }
 
@@ -214,8 +244,45 @@ objNativeFunction* objNativeFunction::createNativeFunction(nativeFn fn) {
 }
 
 //objClass functions
-objClass::objClass() : name(nullptr), superClass(nullptr) {
+shape::shape() : slots(std::make_shared<flatTable<objString*, uint32_t>>()) {}
+
+shape::~shape() {
+	for (auto& transition : transitions) {
+		delete transition.second;
+	}
+}
+
+shape* shape::addField(objString* name) {
+	auto existing = transitions.find(name);
+	if (existing != transitions.end()) {
+		return existing->second;
+	}
+
+	auto* next = new shape();
+	if (slots->size() == fieldCount) {
+		// nothing was added after this shape yet, so the new one can extend the same table
+		next->slots = slots;
+	}
+	else {
+		for (auto& slot : *slots) {
+			if (slot.second < fieldCount)
+				next->slots->insert_or_assign(slot.first, slot.second);
+		}
+	}
+	next->slots->insert_or_assign(name, fieldCount);
+	next->fieldCount = fieldCount + 1;
+
+	transitions.insert_or_assign(name, next);
+	return next;
+}
+
+objClass::objClass() : name(nullptr), superClass(nullptr), rootShape(new shape()) {
 	type = OBJ_CLASS;
+	initialShape = rootShape;
+}
+
+objClass::~objClass() {
+	delete rootShape;
 }
 
 objString* objClass::getName() const {
@@ -223,7 +290,60 @@ objString* objClass::getName() const {
 }
 
 void objClass::tableSet(objString* name, value val) {
+	writeBarrier(name);
+	writeBarrier(val);
 	table.insert_or_assign(name, val);
+	methods.insert_or_assign(name, val);
+	generation++;
+	if (hasSubclasses) {
+		hierarchyGeneration++;
+	}
+	if (symbolIndexed) {
+		indexBySymbol();
+	}
+}
+
+void objClass::indexBySymbol() {
+	symbolIndexed = true;
+	if (flattenedAt != hierarchyGeneration) {
+		flatten();
+	}
+	for (auto& member : methods) {
+		uint32_t symbol = member.first->getSymbol();
+		if (symbol >= symbolMethods.size()) {
+			symbolMethods.resize(symbol + 1, NIL_VAL);
+		}
+		symbolMethods[symbol] = member.second;
+	}
+}
+
+void objClass::flatten() const {
+	if (superClass != nullptr) {
+		if (superClass->flattenedAt != hierarchyGeneration) {
+			superClass->flatten();
+		}
+		methods = superClass->methods;
+	}
+	else {
+		methods.clear();
+	}
+
+	for (auto& member : table) {
+		methods.insert_or_assign(member.first, member.second);
+	}
+	flattenedAt = hierarchyGeneration;
+}
+
+void objClass::addMemberVariable(objString* name, value val) {
+	writeBarrier(name);
+	writeBarrier(val);
+	long slot = initialShape->find(name);
+	if (slot >= 0) {
+		initialFields[slot] = val;
+		return;
+	}
+	initialShape = initialShape->addField(name);
+	initialFields.push_back(val);
 }
 
 value objClass::superTableGet(objString* k) const {
@@ -237,7 +357,11 @@ objClass* objClass::createObjClass(objString* name) {
 }
 
 void objClass::setSuperClass(objClass* cl) {
+	writeBarrier(cl);
 	superClass = cl;
+	cl->hasSubclasses = true;
+	flatten();
+	generation++;
 }
 
 bool objClass::hasInitFunction() const {
@@ -252,7 +376,7 @@ bool objClass::hasInitFunction() const {
 }
 
 //objInstance functions
-objInstance::objInstance() : klass(nullptr) {
+objInstance::objInstance() : klass(nullptr), layout(nullptr) {
 	type = OBJ_INSTANCE;
 }
 
@@ -260,7 +384,8 @@ objInstance* objInstance::createInstance(objClass* kl) {
 	auto* ins = (objInstance*)globalMemory.allocateObject<objInstance>();
 
 	ins->klass = kl;
-	//ins->table = kl->getTable();
+	ins->layout = kl->initialShape;
+	ins->fields = kl->initialFields;
 
 	return ins;
 }
@@ -275,6 +400,7 @@ objList::objList() {
 
 
 void objList::appendValue(value val) {
+	elementBarrier(data.size(), val);
 	data.push_back(val);
 }
 
@@ -293,13 +419,26 @@ size_t objMap::getSize() {
 }
 
 value objMap::getValueAt(const value key) {
-	if (data.count(key) == 0)
+	auto el = data.find(key);
+	if (el == data.end())
 		return NIL_VAL;
 
-	return data.at(key);
+	return el->second;
 }
 
-void objMap::insertElement(const value key, const value val) {
+void objMap::insertElement(value key, const value val) {
+	auto el = data.find(key);
+	if (el != data.end()) {
+		writeBarrier(val);
+		el->second = val;
+		return;
+	}
+	// a view as a key would keep all of its parent alive, for as long as the dictionary is
+	if (IS_STR(key) && AS_STR(key)->parent != nullptr) {
+		key = OBJ_VAL(objString::copyRuntimeString(AS_STR(key)->chars, AS_STR(key)->len));
+	}
+	writeBarrier(key);
+	writeBarrier(val);
 	data.insert_or_assign(key, val);
 }
 
@@ -324,7 +463,7 @@ bool objFile::isOpen() {
 objFile* objFile::createReadFile(objString* path) {
 	auto* fl = (objFile*)globalMemory.allocateObject<objFile>();
 	
-	fl->file = std::fstream(path->getChars(), std::ios::in | std::ios::ate);
+	fl->file = std::fstream(std::string(path->chars, path->len), std::ios::in | std::ios::ate);
 	std::streamsize len = fl->file.tellg();
 	fl->file.seekg(0, std::ios::beg);
 
@@ -336,11 +475,26 @@ objFile* objFile::createReadFile(objString* path) {
 objFile* objFile::createWriteFile(objString* path) {
 	auto* fl = (objFile*)globalMemory.allocateObject<objFile>();
 
-	fl->file = std::fstream(path->getChars(), std::ios::out | std::ios::ate);
+	fl->file = std::fstream(std::string(path->chars, path->len), std::ios::out | std::ios::ate);
 	std::streamsize len = fl->file.tellg();
 	fl->file.seekg(0, std::ios::beg);
 
 	fl->fileSize = len;
 
 	return fl;
-}
\ No newline at end of file
+}
+//objStringBuilder functions
+
+objStringBuilder::objStringBuilder() : buffer() {
+	type = OBJ_STRING_BUILDER;
+}
+
+void objStringBuilder::append(const char* chars, size_t len) {
+	size_t capacity = buffer.capacity();
+	buffer.append(chars, len);
+	globalMemory.resizedBuffer(capacity, buffer.capacity());
+}
+
+objStringBuilder* objStringBuilder::createStringBuilder() {
+	return (objStringBuilder*)globalMemory.allocateObject<objStringBuilder>();
+}
@@ -22,7 +22,7 @@ const std::string stringify(value val) {
 		obj* object = AS_OBJ(val);
 		switch (object->getType()) {
 		case OBJ_STR:
-			return ((objString*)object)->chars;
+			return std::string(((objString*)object)->chars, ((objString*)object)->len);
 		case OBJ_FUN:
 			return ("<fn " + std::string(((objFunction*)object)->name->chars) + ">");
 		case OBJ_UPVALUE:
@@ -99,6 +99,8 @@ const std::string stringify(value val) {
 		}
 		case OBJ_FILE:
 			return "<file>";
+		case OBJ_STRING_BUILDER:
+			return "<string builder>";
 		}
 	}
 	return "<unknown object>";
@@ -139,6 +141,10 @@ value::value() {
 	type = VAL_NIL;
 }
 
+value::value(valType type) {
+	this->type = type;
+}
+
 
 std::ostream& operator<<(std::ostream& os, const value& val) {
 	return os << stringify(val);